@@ -2,45 +2,323 @@
 #include "icons.h"
 #include "term.c"
 
+#include <winternl.h>
+#include <immintrin.h>
+#include <setjmp.h>
+#if COLLA_MSVC
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
 #define ATOMIC_SET(v, x) (InterlockedExchange(&v, (x)))
 #define ATOMIC_CHECK(v)  (InterlockedCompareExchange(&v, 1, 1))
 #define ATOMIC_INC(v) (InterlockedIncrement(&v))
 #define ATOMIC_DEC(v) (InterlockedDecrement(&v))
+#define ATOMIC_ADD(v, x) (InterlockedExchangeAdd(&v, (x)))
 #define ATOMIC_GET(v) (InterlockedOr(&v, 0))
+#define ATOMIC_SET64(v, x) (InterlockedExchange64(&v, (x)))
+#define ATOMIC_CAS64(v, x, cmp) (InterlockedCompareExchange64(&v, (x), (cmp)))
+
+// anything written often by one thread and read by others gets a line of its own
+#define CACHE_LINE 64
+#if COLLA_MSVC
+    #define CACHE_ALIGN __declspec(align(CACHE_LINE))
+#else
+    #define CACHE_ALIGN __attribute__((aligned(CACHE_LINE)))
+#endif
+
+typedef enum {
+    WALKER_BATCH,
+    WALKER_GENERIC,
+    WALKER_ASYNC,
+} walker_e;
+
+const char *walker_names[] = {
+    [WALKER_BATCH]   = "batch",
+    [WALKER_GENERIC] = "generic",
+    [WALKER_ASYNC]   = "async",
+};
+
+typedef enum {
+    OUTPUT_FORMAT_LINES,
+    OUTPUT_FORMAT_NUL,
+    OUTPUT_FORMAT_JSONL,
+} output_format_e;
+
+typedef enum {
+    MATCH_ISA_SCALAR,
+    MATCH_ISA_SSE2,
+    MATCH_ISA_AVX2,
+    MATCH_ISA__COUNT,
+} match_isa_e;
+
+strview_t match_isa_names[MATCH_ISA__COUNT] = {
+    [MATCH_ISA_SCALAR] = cstrv("scalar"),
+    [MATCH_ISA_SSE2]   = cstrv("sse2"),
+    [MATCH_ISA_AVX2]   = cstrv("avx2"),
+};
+
+typedef enum {
+    MATCH_MODE_SUBSTRING,
+    MATCH_MODE_EXACT,
+    MATCH_MODE_GLOB,
+    MATCH_MODE_REGEX,
+    MATCH_MODE_MULTI,
+    MATCH_MODE_FUZZY,
+} match_mode_e;
+
+typedef enum {
+    FILTER_TYPE_FILE    = 1 << 0,
+    FILTER_TYPE_DIR     = 1 << 1,
+    FILTER_TYPE_SYMLINK = 1 << 2,
+    FILTER_TYPE_EXEC    = 1 << 3,
+} filter_type_e;
+
+// 100ns ticks, same as FILETIME
+#define TIME_SECOND 10000000ull
+
+// size of the worker tables, -j can't go past it
+#define MAX_THREADS 64
 
 typedef struct options_t options_t;
 struct options_t {
     bool case_sensitive;
-    bool exact_name;
+    match_mode_e mode;
+    bool multi_suffix;
     bool all_dirs;
+    bool follow;
+    bool one_file_system;
+    int max_depth;
+    int min_depth;
+    // -x / -X, the command and its arguments
+    str_t *exec_args;
+    int exec_count;
+    bool exec_batch;
+    int exec_jobs;
+    bool no_ignore;
+    bool stats;
+    bool stream;
+    bool sorted;
+    output_format_e format;
+    int top;
+    int max_results;
+    walker_e walker;
+    bool drop_caches;
+    bool force_isa;
+    match_isa_e isa;
+    str_t bench_match;
+    bool bench_counters;
+    str_t bench_tree;
+    str_t content;
+    str_t index;
+    bool no_refresh;
+    bool daemon;
+    bool no_daemon;
+    // metadata filters, only checked after the name matched
+    bool filters;
+    u32 types;
+    u64 min_size;
+    u64 max_size;
+    u64 newer;
+    u64 older;
     int j;
     str_t dir;
     str_t tofind;
     str_t tofind_original;
+    str_t *patterns;
+    int pattern_count;
 };
 
 // == GLOBALS =============
 strview_t CURDIR  = { .buf = ".",  .len = 1 };
 strview_t PREVDIR = { .buf = "..", .len = 2 };
 
-volatile long checked_count = 0;
-volatile long found_count = 0;
+volatile long *pattern_found = NULL;
 options_t opt = {0};
 
+// the daemon parses command lines sent by other processes, a bad one has to
+// be answered instead of taking the daemon down. while options_recover is
+// set, errors in the options or the patterns jump back to it with the message
+typedef struct optrecover_t optrecover_t;
+struct optrecover_t {
+    jmp_buf jmp;
+    arena_t *arena;
+    str_t error;
+};
+
+optrecover_t *options_recover = NULL;
+
+#define options_fatal(...) \
+    do { \
+        if (options_recover) { \
+            options_recover->error = str_fmt(options_recover->arena, __VA_ARGS__); \
+            longjmp(options_recover->jmp, 1); \
+        } \
+        fatal(__VA_ARGS__); \
+    } while (0)
+
 int usage(void) {
-    print("usage: find [dir] <filename>\n");
+    print("usage: find [dir] <filename> [more filenames...]\n");
     print("options:\n");
     print("\t-d / -dir         search directory\n");
     print("\t-s / -sensitive   case sensitive\n");
     print("\t-e / -exact       exact filename\n");
+    print("\t-g / -glob        match the whole filename against a glob (* ? [a-z] {a,b})\n");
+    print("\t-r / -regex <re>  match filenames against a regular expression\n");
+    print("\t-f / -fuzzy       fuzzy match the whole path and show the best ones ranked\n");
+    print("\t--type <f|d|l|x>  only files, directories, symlinks or executables, can be repeated\n");
+    print("\t--size <+-n[unit]> at least (+) or at most (-) n bytes, units: b k m g ki mi gi\n");
+    print("\t--newer <time>    modified after time, either a duration (10min, 2h, 3d, 1w) or a date (2024-01-31)\n");
+    print("\t--older <time>    modified before time\n");
+    print("\t-x / -exec <cmd> [args] [;]  run cmd for every match, {} is the path, {/} the name,\n");
+    print("\t                  {//} the parent, {.} and {/.} the same without extension\n");
+    print("\t-X / -exec-batch <cmd> [args] [+]  run cmd with as many matches as fit on one command line\n");
+    print("\t--exec-jobs <n>   commands running at the same time (default: -j)\n");
+    print("\t-c / -content <text> print path:line:col for every line of the matching files\n");
+    print("\t                  that contains text, without a name every file is searched\n");
+    print("\t--top <n>         number of fuzzy results to keep (default: 20)\n");
+    print("\t--max-results <n> stop the walk as soon as n matches were found\n");
     print("\t-a / -all         check all directory, even ones that start with a dot\n");
-    print("\t-j                number of threads (default: 4)\n");
+    print("\t-L / -follow      follow symlinks and junctions to directories, every file is listed once\n");
+    print("\t--one-file-system don't follow links onto other volumes (only links can cross, see -L)\n");
+    print("\t--max-depth <n>   don't go more than n directories down, 1 is only the entries of dir\n");
+    print("\t--min-depth <n>   only show entries at least n directories down\n");
+    print("\t-I / -no-ignore   don't skip files listed in .gitignore/.ignore\n");
+    print("\t-j                number of threads, 1 to 64 (default: 4)\n");
+    print("\t--stats           print per-thread scheduling statistics at the end\n");
+    print("\t--stream          print matches as they are found, on by default when stdout is not a console\n");
+    print("\t--sorted          print matches sorted by path, same output on every run\n");
+    print("\t-0 / -print0      end every match with a null byte instead of a newline, implies --stream\n");
+    print("\t--jsonl           print every match as a json object on its own line, implies --stream\n");
+    print("\t--index <file>    search a saved index of the tree instead of walking it, the index\n");
+    print("\t                  is created if missing and only changed directories are listed again,\n");
+    print("\t                  needs -I, the index doesn't know about ignore files\n");
+    print("\t--no-refresh      use the index as it is, without checking for changes\n");
+    print("\t--daemon          keep the index of -dir in memory, watch it for changes and answer searches\n");
+    print("\t                  made with -I, the index doesn't know about ignore files\n");
+    print("\t--no-daemon       always walk, even if a daemon is running for this directory\n");
+    print("\t--walk <batch|generic|async> directory listing backend (default: batch)\n");
+    print("\t--drop-caches     empty the system file cache before walking, needs an elevated prompt\n");
+    print("\t--isa <scalar|sse2|avx2> force the name matcher implementation (default: best available)\n");
+    print("\t--bench-match <file> time the name matcher over a list of paths (one per line) and exit\n");
+    print("\t--bench-counters  time shared against per-thread counters from 1 to 64 threads and exit\n");
+    print("\t--bench-tree <dir> fill dir with about 1M empty files to compare the walkers on and exit\n");
     return 1;
 }
 
+u64 options__parse_size(strview_t arg, int *sign) {
+    instream_t in = istr_init(arg);
+
+    *sign = 0;
+    if (istr_peek(&in) == '+' || istr_peek(&in) == '-') {
+        *sign = istr_get(&in) == '+' ? 1 : -1;
+    }
+
+    u64 value = 0;
+    if (!istr_get_u64(&in, &value)) {
+        options_fatal("invalid size: %v", arg);
+    }
+
+    strview_t unit = strv_sub(arg, istr_tell(&in), SIZE_MAX);
+    static const struct { const char *name; u64 mult; } units[] = {
+        { "",   1 },
+        { "b",  1 },
+        { "k",  1000ull },
+        { "m",  1000ull * 1000 },
+        { "g",  1000ull * 1000 * 1000 },
+        { "ki", 1024ull },
+        { "mi", 1024ull * 1024 },
+        { "gi", 1024ull * 1024 * 1024 },
+    };
+
+    for (int i = 0; i < arrlen(units); ++i) {
+        strview_t name = strv(units[i].name);
+        if (unit.len != name.len) continue;
+        bool same = true;
+        for (usize k = 0; k < unit.len; ++k) {
+            same &= char_lower(unit.buf[k]) == name.buf[k];
+        }
+        if (same) {
+            return value * units[i].mult;
+        }
+    }
+
+    options_fatal("invalid size unit in %v, use b, k, m, g, ki, mi or gi", arg);
+    return 0;
+}
+
+u64 options__now(void) {
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    return ((u64)now.dwHighDateTime << 32) | now.dwLowDateTime;
+}
+
+// either how long ago (10min, 2h, 3d, 1w) or a local date, YYYY-MM-DD with an optional HH:MM:SS
+u64 options__parse_time(strview_t arg) {
+    instream_t in = istr_init(arg);
+
+    u64 value = 0;
+    if (!istr_get_u64(&in, &value)) {
+        options_fatal("invalid time: %v", arg);
+    }
+
+    if (istr_peek(&in) == '-') {
+        SYSTEMTIME local = { .wYear = (WORD)value };
+        u64 month = 0, day = 0, hour = 0, minute = 0, second = 0;
+        istr_skip(&in, 1);
+        bool ok = istr_get_u64(&in, &month) && istr_get(&in) == '-' && istr_get_u64(&in, &day);
+        if (ok && (istr_peek(&in) == ' ' || istr_peek(&in) == 'T')) {
+            istr_skip(&in, 1);
+            ok = istr_get_u64(&in, &hour) && istr_get(&in) == ':' && 
+                 istr_get_u64(&in, &minute) && istr_get(&in) == ':' && 
+                 istr_get_u64(&in, &second);
+        }
+        if (!ok || !istr_is_finished(&in)) {
+            options_fatal("invalid date: %v, expected YYYY-MM-DD or YYYY-MM-DD HH:MM:SS", arg);
+        }
+
+        local.wMonth = (WORD)month;
+        local.wDay = (WORD)day;
+        local.wHour = (WORD)hour;
+        local.wMinute = (WORD)minute;
+        local.wSecond = (WORD)second;
+
+        SYSTEMTIME utc;
+        FILETIME time;
+        if (!TzSpecificLocalTimeToSystemTime(NULL, &local, &utc) || !SystemTimeToFileTime(&utc, &time)) {
+            options_fatal("invalid date: %v", arg);
+        }
+        return ((u64)time.dwHighDateTime << 32) | time.dwLowDateTime;
+    }
+
+    strview_t unit = strv_sub(arg, istr_tell(&in), SIZE_MAX);
+    static const struct { const char *name; u64 secs; } units[] = {
+        { "s",   1 },
+        { "sec", 1 },
+        { "min", 60 },
+        { "h",   60 * 60 },
+        { "d",   60 * 60 * 24 },
+        { "w",   60 * 60 * 24 * 7 },
+        { "y",   60 * 60 * 24 * 365 },
+    };
+
+    for (int i = 0; i < arrlen(units); ++i) {
+        if (strv_equals(unit, strv(units[i].name))) {
+            return options__now() - value * units[i].secs * TIME_SECOND;
+        }
+    }
+
+    options_fatal("invalid time unit in %v, use s, min, h, d, w or y", arg);
+    return 0;
+}
+
 options_t get_options(arena_t *arena, int argc, char **argv) {
     options_t out = {
+        .max_size = UINT64_MAX,
         .j = 4,
+        .top = 20,
+        .patterns = alloc(arena, str_t, argc),
     };
 
 #define IS_OPT(short, long) strv_equals(arg, strv(short)) || strv_equals(arg, strv(long))
@@ -49,6 +327,9 @@ options_t get_options(arena_t *arena, int argc, char **argv) {
         strview_t arg = strv(argv[i]);
         if (IS_OPT("-d", "-dir")) {
             if ((i + 1) >= argc) {
+                if (options_recover) {
+                    options_fatal("passed option -dir without a directory afterwards");
+                }
                 err("wrong usage");
                 usage();
                 os_abort(1);
@@ -65,25 +346,231 @@ options_t get_options(arena_t *arena, int argc, char **argv) {
             out.case_sensitive = true;
         }
         else if (IS_OPT("-e", "-exact")) {
-            out.exact_name = true;
+            out.mode = MATCH_MODE_EXACT;
+        }
+        else if (IS_OPT("-g", "-glob")) {
+            out.mode = MATCH_MODE_GLOB;
+        }
+        else if (IS_OPT("-f", "-fuzzy")) {
+            out.mode = MATCH_MODE_FUZZY;
+        }
+        else if (strv_equals(arg, strv("--top"))) {
+            if ((i + 1) >= argc) {
+                options_fatal("passed option --top without any number afterwards");
+            }
+            instream_t istr = istr_init(strv(argv[++i]));
+            if (!istr_get_i32(&istr, &out.top) || out.top <= 0) {
+                options_fatal("--top needs a positive number");
+            }
+        }
+        else if (strv_equals(arg, strv("--max-results"))) {
+            if ((i + 1) >= argc) {
+                options_fatal("passed option --max-results without any number afterwards");
+            }
+            instream_t istr = istr_init(strv(argv[++i]));
+            if (!istr_get_i32(&istr, &out.max_results) || out.max_results <= 0) {
+                options_fatal("--max-results needs a positive number");
+            }
+        }
+        else if (IS_OPT("-r", "-regex")) {
+            if ((i + 1) >= argc) {
+                options_fatal("passed option -r without a regex afterwards");
+            }
+            if (!str_is_empty(out.tofind)) {
+                options_fatal("passed multiple files to search: (%v) and (%s)", out.tofind, argv[i + 1]);
+            }
+            out.mode = MATCH_MODE_REGEX;
+            out.tofind = str(arena, argv[++i]);
         }
         else if (IS_OPT("-a", "-all")) {
             out.all_dirs = true;
         }
+        else if (IS_OPT("-x", "-exec") || IS_OPT("-X", "-exec-batch")) {
+            if (out.exec_count) {
+                options_fatal("passed -x or -X more than once");
+            }
+            strview_t option = arg;
+            out.exec_batch = strv_equals(option, strv("-X")) || strv_equals(option, strv("-exec-batch"));
+            // one more for the {} added when there's no placeholder
+            out.exec_args = alloc(arena, str_t, argc - i + 1);
+            while (++i < argc) {
+                arg = strv(argv[i]);
+                if (strv_equals(arg, strv(";")) || (out.exec_batch && strv_equals(arg, strv("+")))) {
+                    break;
+                }
+                out.exec_args[out.exec_count++] = str(arena, arg);
+            }
+            if (!out.exec_count) {
+                options_fatal("passed option %v without a command afterwards", option);
+            }
+        }
+        else if (strv_equals(arg, strv("--exec-jobs"))) {
+            if ((i + 1) >= argc) {
+                options_fatal("passed option --exec-jobs without any number afterwards");
+            }
+            instream_t istr = istr_init(strv(argv[++i]));
+            if (!istr_get_i32(&istr, &out.exec_jobs) || out.exec_jobs <= 0) {
+                options_fatal("--exec-jobs needs a positive number");
+            }
+        }
+        else if (IS_OPT("-L", "-follow")) {
+            out.follow = true;
+        }
+        else if (strv_equals(arg, strv("--one-file-system"))) {
+            out.one_file_system = true;
+        }
+        else if (strv_equals(arg, strv("--max-depth"))) {
+            if ((i + 1) >= argc) {
+                options_fatal("passed option --max-depth without any number afterwards");
+            }
+            instream_t istr = istr_init(strv(argv[++i]));
+            if (!istr_get_i32(&istr, &out.max_depth) || out.max_depth <= 0) {
+                options_fatal("--max-depth needs a positive number");
+            }
+        }
+        else if (strv_equals(arg, strv("--min-depth"))) {
+            if ((i + 1) >= argc) {
+                options_fatal("passed option --min-depth without any number afterwards");
+            }
+            instream_t istr = istr_init(strv(argv[++i]));
+            if (!istr_get_i32(&istr, &out.min_depth) || out.min_depth < 0) {
+                options_fatal("--min-depth needs a number");
+            }
+        }
+        else if (IS_OPT("-I", "-no-ignore")) {
+            out.no_ignore = true;
+        }
+        else if (strv_equals(arg, strv("--stats"))) {
+            out.stats = true;
+        }
+        else if (strv_equals(arg, strv("--stream"))) {
+            out.stream = true;
+        }
+        else if (strv_equals(arg, strv("--sorted"))) {
+            out.sorted = true;
+        }
+        else if (IS_OPT("-0", "-print0")) {
+            out.format = OUTPUT_FORMAT_NUL;
+        }
+        else if (strv_equals(arg, strv("--jsonl"))) {
+            out.format = OUTPUT_FORMAT_JSONL;
+        }
+        else if (strv_equals(arg, strv("--walk"))) {
+            if ((i + 1) >= argc) {
+                options_fatal("passed option --walk without a backend afterwards");
+            }
+            arg = strv(argv[++i]);
+            if (strv_equals(arg, strv("batch"))) {
+                out.walker = WALKER_BATCH;
+            }
+            else if (strv_equals(arg, strv("generic"))) {
+                out.walker = WALKER_GENERIC;
+            }
+            else if (strv_equals(arg, strv("async"))) {
+                out.walker = WALKER_ASYNC;
+            }
+            else {
+                options_fatal("unknown walker (%v), expected batch, generic or async", arg);
+            }
+        }
+        else if (strv_equals(arg, strv("--isa"))) {
+            if ((i + 1) >= argc) {
+                options_fatal("passed option --isa without a name afterwards");
+            }
+            arg = strv(argv[++i]);
+            for (int k = 0; k < MATCH_ISA__COUNT; ++k) {
+                if (strv_equals(arg, match_isa_names[k])) {
+                    out.isa = k;
+                    out.force_isa = true;
+                }
+            }
+            if (!out.force_isa) {
+                options_fatal("unknown isa (%v), expected scalar, sse2 or avx2", arg);
+            }
+        }
+        else if (strv_equals(arg, strv("--type"))) {
+            if ((i + 1) >= argc) {
+                options_fatal("passed option --type without a type afterwards");
+            }
+            strview_t type = strv(argv[++i]);
+            if      (strv_equals(type, strv("f")) || strv_equals(type, strv("file")))       out.types |= FILTER_TYPE_FILE;
+            else if (strv_equals(type, strv("d")) || strv_equals(type, strv("directory")))  out.types |= FILTER_TYPE_DIR;
+            else if (strv_equals(type, strv("l")) || strv_equals(type, strv("symlink")))    out.types |= FILTER_TYPE_SYMLINK;
+            else if (strv_equals(type, strv("x")) || strv_equals(type, strv("executable"))) out.types |= FILTER_TYPE_EXEC;
+            else options_fatal("unknown type %v, use f, d, l or x", type);
+            out.filters = true;
+        }
+        else if (strv_equals(arg, strv("--size"))) {
+            if ((i + 1) >= argc) {
+                options_fatal("passed option --size without a size afterwards");
+            }
+            int sign = 0;
+            u64 size = options__parse_size(strv(argv[++i]), &sign);
+            if (sign >= 0) out.min_size = MAX(out.min_size, size);
+            if (sign <= 0) out.max_size = MIN(out.max_size, size);
+            out.filters = true;
+        }
+        else if (strv_equals(arg, strv("--newer")) || strv_equals(arg, strv("--older"))) {
+            if ((i + 1) >= argc) {
+                options_fatal("passed option %v without a time afterwards", arg);
+            }
+            u64 time = options__parse_time(strv(argv[++i]));
+            if (strv_equals(arg, strv("--newer"))) out.newer = time;
+            else                                  out.older = time;
+            out.filters = true;
+        }
+        else if (IS_OPT("-c", "-content")) {
+            if ((i + 1) >= argc) {
+                options_fatal("passed option %v without any text afterwards", arg);
+            }
+            out.content = str(arena, argv[++i]);
+        }
+        else if (strv_equals(arg, strv("--index"))) {
+            if ((i + 1) >= argc) {
+                options_fatal("passed option --index without a file afterwards");
+            }
+            out.index = str(arena, argv[++i]);
+        }
+        else if (strv_equals(arg, strv("--no-refresh"))) {
+            out.no_refresh = true;
+        }
+        else if (strv_equals(arg, strv("--daemon"))) {
+            out.daemon = true;
+        }
+        else if (strv_equals(arg, strv("--no-daemon"))) {
+            out.no_daemon = true;
+        }
+        else if (strv_equals(arg, strv("--bench-match"))) {
+            if ((i + 1) >= argc) {
+                options_fatal("passed option --bench-match without a file afterwards");
+            }
+            out.bench_match = str(arena, argv[++i]);
+        }
+        else if (strv_equals(arg, strv("--drop-caches"))) {
+            out.drop_caches = true;
+        }
+        else if (strv_equals(arg, strv("--bench-counters"))) {
+            out.bench_counters = true;
+        }
+        else if (strv_equals(arg, strv("--bench-tree"))) {
+            if ((i + 1) >= argc) {
+                options_fatal("passed option --bench-tree without a directory afterwards");
+            }
+            out.bench_tree = str(arena, argv[++i]);
+        }
         else if(strv_equals(arg, strv("-j"))) {
             ++i;
             if (i >= argc) {
-                fatal("passed option -j without any number afterwards");
+                options_fatal("passed option -j without any number afterwards");
             }
             arg = strv(argv[i]);
             instream_t istr = istr_init(arg);
-            istr_get_i32(&istr, &out.j);
+            if (!istr_get_i32(&istr, &out.j) || out.j < 1 || out.j > MAX_THREADS) {
+                options_fatal("-j needs a number between 1 and %d", MAX_THREADS);
+            }
         }
         else {
-            if (!str_is_empty(out.tofind)) {
-                fatal("passed multiple files to search: (%v) and (%v)", out.tofind, arg);
-            }
-            out.tofind = str(arena, arg);
+            out.patterns[out.pattern_count++] = str(arena, arg);
         }
     }
 
@@ -91,25 +578,79 @@ options_t get_options(arena_t *arena, int argc, char **argv) {
         out.dir = str(arena, "./");
     }
 
-    if (str_is_empty(out.tofind)) {
-        fatal("no files passed");
+    if (out.pattern_count > 0) {
+        if (!str_is_empty(out.tofind)) {
+            options_fatal("passed multiple files to search: (%v) and (%v)", out.tofind, out.patterns[0]);
+        }
+        out.tofind = str_dup(arena, out.patterns[0]);
     }
 
-#undef IS_OPT
+    if (str_is_empty(out.tofind) && !out.daemon && str_is_empty(out.content) && !out.bench_counters && str_is_empty(out.bench_tree)) {
+        options_fatal("no files passed");
+    }
 
-    if (out.j == 0) {
-        out.j = 1;
+    // several names are all searched for in the same walk
+    if (out.pattern_count > 1) {
+        if (out.mode != MATCH_MODE_SUBSTRING && out.mode != MATCH_MODE_EXACT) {
+            options_fatal("multiple patterns only work with plain or exact (-e) names");
+        }
+        out.multi_suffix = out.mode == MATCH_MODE_EXACT;
+        out.mode = MATCH_MODE_MULTI;
     }
 
+#undef IS_OPT
+
     return out;
 }
 
+// a job is a directory to list. it only stores its own name, the full path is
+// rebuilt by walking up the parents and only when something actually matches.
+// with the batch walker the directory is opened relative to the parent's handle,
+// so the kernel never has to resolve the whole path again
+//  - open_refs: users of the handle, the listing itself plus every child that
+//    hasn't been opened yet. the handle is closed when it gets to zero
+//  - refs: users of the record, itself plus every child still alive, so that
+//    the names up the chain stay valid. recycled when it gets to zero
+// the name is stored right after the record, both come out of the job pool
 typedef struct jobdata_t jobdata_t;
 struct jobdata_t {
-    str_t path;
-    usize alloc_len;
-    jobdata_t *next;
-    jobdata_t *prev;
+    jobdata_t *parent;
+    str_t name;
+    HANDLE handle;
+    // innermost ignore rules that apply here, shared with the parent
+    // unless this directory has its own ignore files
+    struct ignore_t *ignore;
+    volatile long open_refs;
+    volatile long refs;
+    // size class of the block, -1 if it isn't from the pool
+    int pool_class;
+    // -L only, the volume the directory is on and whether we got here
+    // through a link, in which case the listing's file id was the link's
+    u32 volume;
+    bool is_link;
+    // the root is 0, its entries are at depth 1
+    int depth;
+};
+
+// class i holds blocks of POOL_MIN_BLOCK << i bytes, enough for the record
+// plus the longest name a directory listing can give us
+#define POOL_CLASS_COUNT 5
+#define POOL_MIN_BLOCK   128
+#define POOL_SLAB_SIZE   KB(64)
+#define POOL_CACHE_MAX   256
+#define POOL_BATCH       128
+
+typedef struct poolblock_t poolblock_t;
+struct poolblock_t {
+    poolblock_t *next;
+    // links whole batches in the shared lists
+    poolblock_t *next_batch;
+};
+
+typedef struct poolcache_t poolcache_t;
+struct poolcache_t {
+    poolblock_t *head;
+    int count;
 };
 
 typedef struct result_t result_t;
@@ -117,315 +658,6187 @@ struct result_t {
     strview_t icon;
     str_t before;
     str_t name;
+    str_t match;
     str_t after;
+    int pattern;
 };
 
 darr_define(resarr_t, result_t);
 
+// == WORK STEALING ======
+//
+// every worker owns a chase-lev deque: the owner pushes and pops at the bottom
+// (so it keeps going depth first on what it just found), the other workers steal
+// from the top. rings only ever grow, the old ones are left in the owner's arena
+// so a thief that is still reading from one never touches freed memory
+
+typedef struct jobring_t jobring_t;
+struct jobring_t {
+    i64 mask;
+    jobdata_t **items;
+};
+
+// thieves hammer top, keep it away from the owner's own fields
+typedef struct jobdeque_t jobdeque_t;
+struct CACHE_ALIGN jobdeque_t {
+    volatile i64 top;
+    volatile i64 bottom;
+    jobring_t *volatile ring;
+};
+
+#define JOBDEQUE_INITIAL_CAP 256
+#define JOB_BATCH_MAX        256
+#define WALK_BUFFER_SIZE     KB(64)
+
+// workers sit next to each other in one array, the alignment pads each one to
+// whole cache lines so a worker bumping its counters never invalidates the line
+// another one is working on
 typedef struct worker_t worker_t;
-struct worker_t {
+struct CACHE_ALIGN worker_t {
     arena_t arena;
     arena_t scratch;
     resarr_t *results;
-    jobdata_t *jobs;
+    jobdeque_t deque;
+    poolcache_t pool[POOL_CLASS_COUNT];
+    u8 *slab;
+    usize slab_left;
+    // children of the directory being listed, not pushed yet
+    jobdata_t **batch;
+    long batch_count;
+    // --walk async, listings in flight on this worker's completion port
+    HANDLE port;
+    struct asyncop_t *async_free;
+    int inflight;
+    // waiting on the port with free buffers, new jobs post a packet to it
+    volatile long port_parked;
+    u8 *walk_buf;
+    struct dfa_t *dfa;
+    struct fuzzyheap_t *fuzzy;
+    // full path of the directory being listed, rebuilt once per job
+    char *path_buf;
+    usize path_cap;
+    usize path_prefix;
+    u64 path_job;
+    jobdata_t *path_dir;
+    // pending stream output
+    char *out_buf;
+    usize out_cap;
+    usize out_len;
+    i64 out_last_flush;
+    u64 out_records;
+    // matches kept back for --sorted
+    str_t *sorted;
+    usize sorted_count;
+    usize sorted_cap;
+    u32 rng;
+    // stats, only written by the owner. checked and found are also read by
+    // the ui while the walk goes on, a slightly stale value is fine there
+    u64 checked;
+    u64 found;
+    u64 jobs_done;
+    u64 entries;
+    u64 steals;
+    u64 failed_steals;
+    u64 parks;
+    i64 idle_ticks;
+    u64 ignore_files;
+    u64 ignored;
+    u64 stats_issued;
+    u64 stats_avoided;
+    u64 async_reads;
+    u64 async_max_inflight;
+    u64 visited_count;
+    i64 visited_ticks;
+    u64 link_cycles;
+    u64 link_dupes;
+    u64 pruned_depth;
+    u64 pruned_volume;
+    u64 hidden_min_depth;
+    u64 batches_published;
+    u64 wake_locks;
+    u64 wake_locks_unbatched;
+    u64 pool_carved;
+    u64 pool_reused;
+    u64 pool_slab_bytes;
+    // content search
+    char *content_buf;
+    u64 content_read;
+    u64 content_mapped;
+    u64 content_binary;
 };
 
-oshandle_t threads[64] = {0};
-worker_t data[64] = {0};
+oshandle_t threads[MAX_THREADS] = {0};
+worker_t workers[MAX_THREADS] = {0};
+
+u64 workers_checked(void) {
+    u64 total = 0;
+    for (int i = 0; i < opt.j; ++i) {
+        total += workers[i].checked;
+    }
+    return total;
+}
+
+u64 workers_found(void) {
+    u64 total = 0;
+    for (int i = 0; i < opt.j; ++i) {
+        total += workers[i].found;
+    }
+    return total;
+}
 
-jobdata_t *jobs = NULL;
-jobdata_t *freelist = NULL;
-oshandle_t jobs_mutex = {0};
-volatile long should_quit = false;
+// the cancellation token, see walk_cancel. read for every entry, so it
+// doesn't share a line with pending_jobs which changes for every directory
+CACHE_ALIGN volatile long should_quit = false;
+volatile long cancel_reason = 0;
 
-oshandle_t job_notif = {0};
+// number of directories that have been pushed but not fully listed yet,
+// the walk is over once this gets back to zero
+CACHE_ALIGN volatile long pending_jobs = 0;
+volatile long walk_done = false;
+i64 walk_begin = 0;
+i64 walk_end = 0;
 
-volatile long jobs_in_progess = 0;
+// workers that can't find anything to steal park on park_notif, whoever pushes
+// new work bumps work_epoch and wakes them up. done_notif is signalled once
+// when the walk finishes so the ui doesn't have to poll
+oshandle_t park_mtx = {0};
+oshandle_t park_notif = {0};
+oshandle_t done_notif = {0};
+volatile long parked_count = 0;
+volatile long work_epoch = 0;
+// async workers that still have reads in flight can't sleep on park_notif,
+// they block on their completion port and get an empty packet instead
+volatile long port_parked_count = 0;
 
-oshandle_t print_mtx = {0};
+#define WORKER_PORT_WAKE_KEY 1
 
-#define PRINT(...) do { os_mutex_lock(print_mtx); pretty_print(scratch, __VA_ARGS__); os_mutex_unlock(print_mtx); } while (0)
+#define WORKER_SPIN_ROUNDS 16
 
-void try_add_path(worker_t *data, strview_t path, strview_t name, bool is_dir) {
-    arena_t before = data->arena;
+oshandle_t print_mtx = {0};
 
-    arena_t scratch = data->scratch;
+jobring_t *jobring_make(arena_t *arena, i64 cap) {
+    jobring_t *ring = alloc(arena, jobring_t);
+    ring->mask = cap - 1;
+    ring->items = alloc(arena, jobdata_t *, cap);
+    return ring;
+}
 
-    ATOMIC_INC(checked_count);
+// owner only, thieves see all of them at once when bottom moves
+void jobdeque_push_many(worker_t *data, jobdata_t **jobs, i64 count) {
+    jobdeque_t *dq = &data->deque;
+    i64 b = dq->bottom;
+    i64 t = dq->top;
+    jobring_t *ring = dq->ring;
 
-    strview_t current = name;
-    if (!opt.case_sensitive) {
-        str_t filename = str(&scratch, current);
-        str_upper(&filename);
-        current = strv(filename);
+    if ((b - t + count) > (ring->mask + 1)) {
+        i64 cap = (ring->mask + 1) * 2;
+        while ((b - t + count) > cap) {
+            cap *= 2;
+        }
+        jobring_t *bigger = jobring_make(&data->arena, cap);
+        for (i64 i = t; i < b; ++i) {
+            bigger->items[i & bigger->mask] = ring->items[i & ring->mask];
+        }
+        MemoryBarrier();
+        dq->ring = ring = bigger;
     }
 
-    result_t res = { .before = str(&data->arena, path) };
+    for (i64 i = 0; i < count; ++i) {
+        ring->items[(b + i) & ring->mask] = jobs[i];
+    }
+    MemoryBarrier();
+    dq->bottom = b + count;
+}
 
-    usize index = 0;
+// owner only
+void jobdeque_push(worker_t *data, jobdata_t *job) {
+    jobdeque_push_many(data, &job, 1);
+}
 
-    if (opt.exact_name) {
-        if (!strv_ends_with_view(current, strv(opt.tofind))) {
-            return;
-        }
+// owner only
+jobdata_t *jobdeque_pop(jobdeque_t *dq) {
+    i64 b = dq->bottom - 1;
+    jobring_t *ring = dq->ring;
+    // full barrier, the store to bottom must be visible before we read top
+    ATOMIC_SET64(dq->bottom, b);
+    i64 t = dq->top;
 
-        index = current.len - opt.tofind.len;
+    if (t > b) {
+        dq->bottom = b + 1;
+        return NULL;
     }
-    else {
-        index = strv_find_view(current, strv(opt.tofind), 0);
-        if (index == STR_NONE) {
-            return;
+
+    jobdata_t *job = ring->items[b & ring->mask];
+
+    if (t == b) {
+        // last job in the deque, a thief might be going for the same one
+        if (ATOMIC_CAS64(dq->top, t + 1, t) != t) {
+            job = NULL;
         }
+        dq->bottom = b + 1;
     }
 
-    //res.name = strv_sub(name, 0, index);
-    res.name = str(&data->arena, strv_sub(name, 0, index));
-    res.after = str(&data->arena, strv_sub(name, index + opt.tofind.len, SIZE_MAX));
-    
-    if (res.before.buf[0] == '.' &&
-            (res.before.buf[1] == '/' ||
-             res.before.buf[1] == '\\')
-       ) {
-        // res.before = str(&data->arena, strv_remove_prefix(res.before, 2));
-        res.before.buf += 2;
-        res.before.len -= 2;
-    }
+    return job;
+}
 
-    if (is_dir) {
-        res.icon = icons[ICON_STYLE_NERD][ICON_FOLDER];
+// any thread
+jobdata_t *jobdeque_steal(jobdeque_t *dq) {
+    i64 t = dq->top;
+    MemoryBarrier();
+    i64 b = dq->bottom;
+
+    if (t >= b) {
+        return NULL;
     }
-    else {
-        strview_t ext;
-        os_file_split_path(name, NULL, NULL, &ext);
-        res.icon = ext_to_ico(ext);
+
+    jobring_t *ring = dq->ring;
+    jobdata_t *job = ring->items[t & ring->mask];
+
+    if (ATOMIC_CAS64(dq->top, t + 1, t) != t) {
+        return NULL;
     }
-    
-    ATOMIC_INC(found_count);
-
-#if 0
-    PRINT(
-        "<green>%v</> <grey>%v<yellow>%v<green>%v<yellow>%v</>\n",
-        res.icon,
-        res.before,
-        res.name,
-        opt.tofind_original,
-        res.after
-    );
-#endif
 
-    data->arena = before;
-    // darr_push(&data->arena, data->results, res);
+    return job;
 }
 
-void add_dirs(worker_t *data, strview_t path) {
-    arena_t scratch = data->scratch;
-    dir_t *dir = os_dir_open(&scratch, path);
-    // dir_t *dir = os_dir_open(&data->arena, path);
-
-    // dir_foreach(&data->arena, entry, dir) {
-    dir_foreach(&scratch, entry, dir) {
-        if (strv_equals(strv(entry->name), CURDIR) ||
-            strv_equals(strv(entry->name), PREVDIR))
-        {
-            continue;
+bool jobs_available(void) {
+    for (int i = 0; i < opt.j; ++i) {
+        if (workers[i].deque.top < workers[i].deque.bottom) {
+            return true;
         }
+    }
+    return false;
+}
 
-        if (entry->type == DIRTYPE_DIR) {
-            if (!opt.all_dirs && entry->name.buf[0] == '.') {
-                continue;
-            }
+// true if this call took worker off its port, whoever does that owes it a packet
+// or has to find out on its own that it doesn't need one
+bool worker_port_unpark(worker_t *worker) {
+    if (InterlockedCompareExchange(&worker->port_parked, 0, 1) != 1) {
+        return false;
+    }
+    ATOMIC_DEC(port_parked_count);
+    return true;
+}
 
-            // jobdata_t *newjob = alloc(&data->arena, jobdata_ t);
-            // newjob->path = strv(fullpath);
+void worker__wake_ports(long count) {
+    for (int i = 0; i < opt.j && count > 0; ++i) {
+        if (workers[i].port_parked && worker_port_unpark(&workers[i])) {
+            PostQueuedCompletionStatus(workers[i].port, 0, WORKER_PORT_WAKE_KEY, NULL);
+            count--;
+        }
+    }
+}
 
-            str_t fullpath = str_fmt(&scratch, "%v%v/", path, entry->name);
+// wakes up to count parked workers, one for every job just pushed
+void worker_wake(worker_t *data, long count) {
+    // the same goes for workers parked on their port
+    if (ATOMIC_GET(port_parked_count)) {
+        worker__wake_ports(count);
+    }
 
-            os_mutex_lock(jobs_mutex);
-            
-            jobdata_t *newjob = freelist;
-            
-            if (newjob) {
-                dlist_pop(freelist, newjob);
-                if (newjob->alloc_len >= fullpath.len) {
-                    memcpy(newjob->path.buf, fullpath.buf, fullpath.len);
-                    newjob->path.len = fullpath.len;
-                }
-            }
-            else {
-                newjob = alloc(&data->arena, jobdata_t);
-                newjob->path = str_dup(&data->arena, fullpath);
-                newjob->alloc_len = fullpath.len;
-            }
+    // ATOMIC_GET is a full barrier, so either we see the parked worker or
+    // it sees the job we just pushed when it checks again before sleeping
+    long parked = ATOMIC_GET(parked_count);
+    if (parked == 0) {
+        return;
+    }
 
-            // newjob->path = strv(fullpath);
+    data->wake_locks++;
+    // pushing the jobs one at a time would have locked once for each of them
+    data->wake_locks_unbatched += count;
 
-            dlist_push(jobs, newjob);
-                
-            os_mutex_unlock(jobs_mutex);
+    os_mutex_lock(park_mtx);
+        ATOMIC_INC(work_epoch);
+    os_mutex_unlock(park_mtx);
 
-            os_cond_signal(job_notif);
+    if (count >= parked) {
+        os_cond_broadcast(park_notif);
+    }
+    else {
+        for (long i = 0; i < count; ++i) {
+            os_cond_signal(park_notif);
         }
-
-        try_add_path(data, path, strv(entry->name), entry->type == DIRTYPE_DIR); 
     }
 }
 
-int worker(u64 id, void *udata) {
-    COLLA_UNUSED(id);
+void worker_park(worker_t *data) {
+    long epoch = ATOMIC_GET(work_epoch);
+    ATOMIC_INC(parked_count);
 
-    worker_t *data = udata;
-    
-    while (!ATOMIC_CHECK(should_quit)) {
-        if (!os_mutex_try_lock(jobs_mutex)) {
-            continue;
+    if (!jobs_available() && !ATOMIC_CHECK(should_quit)) {
+        data->parks++;
+        os_mutex_lock(park_mtx);
+        while (ATOMIC_GET(work_epoch) == epoch && !ATOMIC_CHECK(should_quit)) {
+            os_cond_wait(park_notif, park_mtx, OS_WAIT_INFINITE);
         }
+        os_mutex_unlock(park_mtx);
+    }
 
-        while (!jobs && !ATOMIC_CHECK(should_quit)) {
-            os_cond_wait(job_notif, jobs_mutex, OS_WAIT_INFINITE);
-        }
+    ATOMIC_DEC(parked_count);
+}
 
-        jobdata_t *job = jobs;
-        dlist_pop(jobs, job);
-        
-        ATOMIC_INC(jobs_in_progess);
-        
-        os_mutex_unlock(jobs_mutex);
+void walk_finish(void) {
+    os_mutex_lock(park_mtx);
+        // a cancelled walk still gets here once the last job drops
+        if (!walk_done) {
+            walk_end = term__get_ticks();
+        }
+        ATOMIC_SET(walk_done, 1);
+        ATOMIC_SET(should_quit, 1);
+    os_mutex_unlock(park_mtx);
 
-        if (job) {
-            add_dirs(data, strv(job->path));
+    os_cond_broadcast(park_notif);
+    os_cond_broadcast(done_notif);
 
-            os_mutex_lock(jobs_mutex);
-                dlist_push(freelist, job);
-            os_mutex_unlock(jobs_mutex);
+    // async workers wait on their port, a packet is how they notice should_quit
+    for (int i = 0; i < opt.j; ++i) {
+        if (workers[i].port) {
+            PostQueuedCompletionStatus(workers[i].port, 0, WORKER_PORT_WAKE_KEY, NULL);
         }
-
-        ATOMIC_DEC(jobs_in_progess);
     }
-
-    return 0;
 }
 
-// int loading_thread(u64 id, void *udata) {
-//     COLLA_UNUSED(id);
-//     COLLA_UNUSED(udata);
-//
-//     const int frame_time = 3600;
-//
-//     char loading_anim[] = "|/-\\|/-\\";
-//     int loading_timer = frame_time;
-//     int frame = 0;
+// == CANCELLATION ========
 //
-//     while(!ATOMIC_CHECK(should_quit)) {
-//         loading_timer--;
-//         if (loading_timer <= 0) {
-//             frame = (frame + 1) % (arrlen(loading_anim) - 1);
-//             loading_timer = frame_time;
-//         }
-//
-//         print(" %c files checked: %d\r", loading_anim[frame], ATOMIC_GET(checked_count));
-//     }
-//
-//     return 0;
-// }
+// should_quit is the one token everything stops on: the walk running out of
+// jobs, --max-results being reached, the reader of the pipe going away or 'q'
+// in the ui. setting it goes through walk_finish, so parked workers and the ui
+// are woken up by the same broadcast. workers check it before every job and
+// between every chunk of a listing and stop pushing children once it's set,
+// whatever is still in the deques is simply dropped. the first reason wins and
+// is kept for --stats
 
-struct {
-    spinner_t spinner;
-    bool finished;
-    bool should_print;
-} app = {0};
+typedef enum {
+    CANCEL_NONE,
+    CANCEL_MAX_RESULTS,
+    CANCEL_OUTPUT_CLOSED,
+    CANCEL_USER,
+} cancel_e;
 
-bool app_update(arena_t *arena, float dt, void *udata) {
+const char *cancel_names[] = {
+    [CANCEL_NONE]          = "no",
+    [CANCEL_MAX_RESULTS]   = "max results reached",
+    [CANCEL_OUTPUT_CLOSED] = "output closed",
+    [CANCEL_USER]          = "cancelled by user",
+};
+
+void walk_cancel(cancel_e reason) {
+    InterlockedCompareExchange(&cancel_reason, reason, CANCEL_NONE);
+    walk_finish();
+}
+
+// plain read, it's checked for every entry and only ever goes from 0 to 1
+static inline bool walk_cancelled(void) {
+    return should_quit != 0;
+}
+
+// only --max-results needs a count shared by everybody
+volatile long results_claimed = 0;
+
+// counts one more match, with --max-results it also takes one of the slots
+// and returns false if they are all gone. whoever takes the last one stops
+// the walk, the others racing with it back off
+bool result_claim(worker_t *data) {
+    if (opt.max_results) {
+        long count = ATOMIC_INC(results_claimed);
+        if (count > opt.max_results) {
+            ATOMIC_DEC(results_claimed);
+            return false;
+        }
+        if (count == opt.max_results) {
+            walk_cancel(CANCEL_MAX_RESULTS);
+        }
+    }
+    data->found++;
+    return true;
+}
+
+str_t jobdata_path(arena_t *arena, jobdata_t *job) {
+    usize len = 0;
+    for (jobdata_t *j = job; j; j = j->parent) {
+        len += j->name.len + (j->parent ? 1 : 0);
+    }
+
+    str_t out = { .buf = alloc(arena, char, len + 1), .len = len };
+    usize cur = len;
+
+    for (jobdata_t *j = job; j; j = j->parent) {
+        if (j->parent) {
+            out.buf[--cur] = '/';
+        }
+        cur -= j->name.len;
+        memcpy(out.buf + cur, j->name.buf, j->name.len);
+    }
+
+    return out;
+}
+
+// relative path of name inside job, without the leading "./". the directory part
+// only changes when the job does, jobs_done tells them apart even when a job
+// record gets recycled and the async walker goes back and forth between the
+// ones it has in flight. the view is only valid until the next call
+strview_t worker_path(worker_t *data, jobdata_t *job, strview_t name) {
+    if (data->path_job != data->jobs_done || data->path_dir != job || !data->path_buf) {
+        arena_t scratch = data->scratch;
+        strview_t prefix = strv(jobdata_path(&scratch, job));
+        if (prefix.len >= 2 && prefix.buf[0] == '.' && (prefix.buf[1] == '/' || prefix.buf[1] == '\\')) {
+            prefix = strv_remove_prefix(prefix, 2);
+        }
+
+        usize needed = prefix.len + MAX_PATH * 4;
+        if (needed > data->path_cap) {
+            data->path_cap = MAX(needed * 2, KB(4));
+            data->path_buf = alloc(&data->arena, char, data->path_cap);
+        }
+
+        // job paths already end with a slash
+        memcpy(data->path_buf, prefix.buf, prefix.len);
+        data->path_prefix = prefix.len;
+        data->path_job = data->jobs_done;
+        data->path_dir = job;
+    }
+
+    memcpy(data->path_buf + data->path_prefix, name.buf, name.len);
+    return strv(data->path_buf, data->path_prefix + name.len);
+}
+
+// == OUTPUT ===============
+//
+// in stream mode every worker formats its matches into its own buffer and hands
+// it to the writer in big chunks, so the lock is taken once per flush instead of
+// once per line and lines from different threads never get mixed up. buffers are
+// flushed when full, before a worker parks and every OUTPUT_FLUSH_MS while it
+// keeps finding things, which is what gets the first results out right away.
+// if the other end of the pipe goes away (fd foo | head) the write fails and
+// the walk is stopped
+//
+// -0 and --jsonl are for other programs: no ui, no icons, no markup, just the
+// bytes, and the buffers are big enough that a pipe gets a few large writes
+// instead of many small ones. a record is made of parts, the ones coming from
+// the file system are escaped for --jsonl and copied as they are otherwise
+
+#define OUTPUT_BUFFER_SIZE         KB(64)
+#define OUTPUT_MACHINE_BUFFER_SIZE MB(1)
+#define OUTPUT_FLUSH_MS            10
+
+struct {
+    oshandle_t handle;
+    oshandle_t mtx;
+    i64 flush_ticks;
+    i64 begin;
+    volatile long closed;
+    // stats, only touched with mtx held
+    u64 writes;
+    u64 bytes;
+} output = {0};
+
+typedef struct outpart_t outpart_t;
+struct outpart_t {
+    strview_t text;
+    bool escape;
+};
+
+// mtx held
+void output__write(strview_t data) {
+    if (ATOMIC_CHECK(output.closed)) {
+        return;
+    }
+
+    usize written = os_file_write(output.handle, data.buf, data.len);
+    output.writes++;
+    output.bytes += written;
+    if (written != data.len) {
+        ATOMIC_SET(output.closed, 1);
+    }
+}
+
+void output_write(strview_t data) {
+    os_mutex_lock(output.mtx);
+        bool was_closed = ATOMIC_CHECK(output.closed);
+        output__write(data);
+        bool closed_now = !was_closed && ATOMIC_CHECK(output.closed);
+    os_mutex_unlock(output.mtx);
+
+    // nobody is reading anymore, no point in walking the rest of the tree
+    if (closed_now) {
+        walk_cancel(CANCEL_OUTPUT_CLOSED);
+    }
+}
+
+void output_flush(worker_t *data) {
+    if (data->out_len) {
+        output_write(strv(data->out_buf, data->out_len));
+        data->out_len = 0;
+    }
+    data->out_last_flush = term__get_ticks();
+}
+
+// length of the utf-8 sequence at s, 0 if it isn't a valid one
+usize output__utf8_len(const u8 *s, usize n) {
+    u8 c = s[0];
+    usize len = 0;
+    u8 lo = 0x80, hi = 0xBF;
+
+    if      (c >= 0xC2 && c <= 0xDF) len = 2;
+    else if (c == 0xE0)              { len = 3; lo = 0xA0; }
+    else if (c == 0xED)              { len = 3; hi = 0x9F; }
+    else if (c >= 0xE1 && c <= 0xEF) len = 3;
+    else if (c == 0xF0)              { len = 4; lo = 0x90; }
+    else if (c == 0xF4)              { len = 4; hi = 0x8F; }
+    else if (c >= 0xF1 && c <= 0xF3) len = 4;
+    else return 0;
+
+    if (n < len || s[1] < lo || s[1] > hi) {
+        return 0;
+    }
+    for (usize i = 2; i < len; ++i) {
+        if ((s[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+    }
+    return len;
+}
+
+// one character of a json string: writes it to out, escaped if needed, and
+// returns how many bytes of s it took. json has to be utf-8 but file contents
+// don't, a byte that doesn't start a valid sequence becomes U+FFFD
+usize output__json_char(const u8 *s, usize n, char out[6], usize *out_len) {
+    const char *hex = "0123456789abcdef";
+    u8 c = s[0];
+
+    if (c >= 0x80) {
+        usize len = output__utf8_len(s, n);
+        if (!len) {
+            memcpy(out, "\xEF\xBF\xBD", 3);
+            *out_len = 3;
+            return 1;
+        }
+        memcpy(out, s, len);
+        *out_len = len;
+        return len;
+    }
+
+    *out_len = 2;
+    switch (c) {
+        case '"':  memcpy(out, "\\\"", 2); return 1;
+        case '\\': memcpy(out, "\\\\", 2); return 1;
+        case '\n': memcpy(out, "\\n", 2);  return 1;
+        case '\r': memcpy(out, "\\r", 2);  return 1;
+        case '\t': memcpy(out, "\\t", 2);  return 1;
+    }
+    if (c < 0x20) {
+        memcpy(out, "\\u00", 4);
+        out[4] = hex[c >> 4];
+        out[5] = hex[c & 15];
+        *out_len = 6;
+        return 1;
+    }
+
+    out[0] = c;
+    *out_len = 1;
+    return 1;
+}
+
+static inline bool output__is_json(outpart_t part) {
+    return part.escape && opt.format == OUTPUT_FORMAT_JSONL;
+}
+
+// printable ascii other than " and \ goes into a json string as it is, which
+// is nearly every byte of a path, so those skip output__json_char
+static inline bool output__json_plain(u8 c) {
+    return c >= 0x20 && c < 0x80 && c != '"' && c != '\\';
+}
+
+usize output__part_len(outpart_t part) {
+    if (!output__is_json(part)) {
+        return part.text.len;
+    }
+    const u8 *text = (const u8 *)part.text.buf;
+    usize len = 0;
+    char tmp[6];
+    for (usize i = 0; i < part.text.len;) {
+        if (output__json_plain(text[i])) {
+            len++;
+            i++;
+            continue;
+        }
+        usize out_len = 0;
+        i += output__json_char(text + i, part.text.len - i, tmp, &out_len);
+        len += out_len;
+    }
+    return len;
+}
+
+usize output__put_part(char *dst, outpart_t part) {
+    if (!output__is_json(part)) {
+        memcpy(dst, part.text.buf, part.text.len);
+        return part.text.len;
+    }
+    const u8 *text = (const u8 *)part.text.buf;
+    usize len = 0;
+    for (usize i = 0; i < part.text.len;) {
+        usize run = i;
+        while (run < part.text.len && output__json_plain(text[run])) {
+            run++;
+        }
+        if (run > i) {
+            memcpy(dst + len, text + i, run - i);
+            len += run - i;
+            i = run;
+            continue;
+        }
+        usize out_len = 0;
+        i += output__json_char(text + i, part.text.len - i, dst + len, &out_len);
+        len += out_len;
+    }
+    return len;
+}
+
+void output_record(worker_t *data, outpart_t *parts, int count) {
+    usize len = 0;
+    for (int i = 0; i < count; ++i) {
+        len += output__part_len(parts[i]);
+    }
+
+    data->out_records++;
+
+    if (data->out_len + len > data->out_cap) {
+        output_flush(data);
+    }
+
+    if (len <= data->out_cap) {
+        for (int i = 0; i < count; ++i) {
+            data->out_len += output__put_part(data->out_buf + data->out_len, parts[i]);
+        }
+        return;
+    }
+
+    // a minified file can have a single line bigger than the whole buffer,
+    // it goes out in pieces but with the lock held so nothing gets in between
+    os_mutex_lock(output.mtx);
+        bool was_closed = ATOMIC_CHECK(output.closed);
+        char piece[KB(4)];
+        usize piece_len = 0;
+        for (int i = 0; i < count; ++i) {
+            const u8 *text = (const u8 *)parts[i].text.buf;
+            usize text_len = parts[i].text.len;
+            bool json = output__is_json(parts[i]);
+            for (usize k = 0; k < text_len;) {
+                if (piece_len + 6 > sizeof(piece)) {
+                    output__write(strv(piece, piece_len));
+                    piece_len = 0;
+                }
+                if (json) {
+                    usize out_len = 0;
+                    k += output__json_char(text + k, text_len - k, piece + piece_len, &out_len);
+                    piece_len += out_len;
+                }
+                else {
+                    piece[piece_len++] = (char)text[k++];
+                }
+            }
+        }
+        output__write(strv(piece, piece_len));
+        bool closed_now = !was_closed && ATOMIC_CHECK(output.closed);
+    os_mutex_unlock(output.mtx);
+
+    if (closed_now) {
+        walk_cancel(CANCEL_OUTPUT_CLOSED);
+    }
+}
+
+// with several patterns every line says which one matched, the same
+// [pattern] tag as the ui, or a "pattern" field with --jsonl. pass -1 when
+// there's no pattern to show
+void output_line(worker_t *data, strview_t path, int pattern) {
+    bool tagged = opt.mode == MATCH_MODE_MULTI && pattern >= 0;
+    strview_t tag = tagged ? strv(opt.patterns[pattern]) : STRV_EMPTY;
+
+    // the common case, skips the record machinery
+    if (!tagged && opt.format != OUTPUT_FORMAT_JSONL && data->out_len + path.len + 1 <= data->out_cap) {
+        memcpy(data->out_buf + data->out_len, path.buf, path.len);
+        data->out_len += path.len;
+        data->out_buf[data->out_len++] = opt.format == OUTPUT_FORMAT_NUL ? '\0' : '\n';
+        data->out_records++;
+        return;
+    }
+
+    switch (opt.format) {
+        case OUTPUT_FORMAT_LINES:
+            if (tagged) {
+                output_record(data, (outpart_t[]){ { path }, { strv(" [") }, { tag }, { strv("]\n") } }, 4);
+            }
+            else {
+                output_record(data, (outpart_t[]){ { path }, { strv("\n") } }, 2);
+            }
+            break;
+        case OUTPUT_FORMAT_NUL:
+            if (tagged) {
+                output_record(data, (outpart_t[]){ { path }, { strv(" [") }, { tag }, { strv("]\0", 2) } }, 4);
+            }
+            else {
+                output_record(data, (outpart_t[]){ { path }, { strv("\0", 1) } }, 2);
+            }
+            break;
+        case OUTPUT_FORMAT_JSONL:
+            if (tagged) {
+                output_record(data, (outpart_t[]){ { strv("{\"path\":\"") }, { path, true }, { strv("\",\"pattern\":\"") }, { tag, true }, { strv("\"}\n") } }, 5);
+            }
+            else {
+                output_record(data, (outpart_t[]){ { strv("{\"path\":\"") }, { path, true }, { strv("\"}\n") } }, 3);
+            }
+            break;
+    }
+}
+
+// -content hits, path:line:col:text or an object with the same fields
+void output_hit(worker_t *data, strview_t path, u64 line, u64 column, strview_t text) {
+    arena_t scratch = data->scratch;
+    if (opt.format == OUTPUT_FORMAT_JSONL) {
+        str_t fields = str_fmt(&scratch, "\",\"line\":%llu,\"column\":%llu,\"text\":\"", line, column);
+        output_record(data, (outpart_t[]){ { strv("{\"path\":\"") }, { path, true }, { strv(fields) }, { text, true }, { strv("\"}\n") } }, 5);
+        return;
+    }
+
+    str_t numbers = str_fmt(&scratch, ":%llu:%llu:", line, column);
+    strview_t end = opt.format == OUTPUT_FORMAT_NUL ? strv("\0", 1) : strv("\n");
+    output_record(data, (outpart_t[]){ { path }, { strv(numbers) }, { text }, { end } }, 4);
+}
+
+void output_maybe_flush(worker_t *data) {
+    if (data->out_len && (term__get_ticks() - data->out_last_flush) >= output.flush_ticks) {
+        output_flush(data);
+    }
+}
+
+// with -0 and --jsonl stdout belongs to the other program, so the stats go to
+// stderr and without colours
+void output_stats(arena_t scratch, strview_t text) {
+    if (opt.format == OUTPUT_FORMAT_LINES) {
+        pretty_print(scratch, "%v", text);
+        return;
+    }
+
+    char *plain = alloc(&scratch, char, text.len);
+    usize len = 0;
+    for (usize i = 0; i < text.len; ++i) {
+        if (text.buf[i] == '<') {
+            while (i < text.len && text.buf[i] != '>') {
+                i++;
+            }
+            continue;
+        }
+        plain[len++] = text.buf[i];
+    }
+
+    DWORD written = 0;
+    WriteFile(GetStdHandle(STD_ERROR_HANDLE), plain, (DWORD)len, &written, NULL);
+}
+
+// == SORTED OUTPUT ===============
+//
+// with --sorted nothing is written while walking, every worker keeps its own
+// matches and msd radix sorts them by path bytes right before it exits, so the
+// sorting happens in parallel. the main thread then only has to do a k-way
+// merge of the sorted runs through a small heap while writing them out.
+// with several patterns the pattern index rides along after a null byte,
+// which sorts before anything a path can have at that point
+
+#define SORT_INSERTION_THRESHOLD 32
+
+void sorted_push(worker_t *data, strview_t path, int pattern) {
+    if (data->sorted_count >= data->sorted_cap) {
+        usize new_cap = MAX(data->sorted_cap * 2, 1024);
+        str_t *items = alloc(&data->arena, str_t, new_cap);
+        if (data->sorted_count) {
+            memcpy(items, data->sorted, sizeof(str_t) * data->sorted_count);
+        }
+        data->sorted = items;
+        data->sorted_cap = new_cap;
+    }
+    if (opt.mode == MATCH_MODE_MULTI) {
+        str_t tagged = str_fmt(&data->arena, "%v %d", path, pattern);
+        tagged.buf[path.len] = '\0';
+        data->sorted[data->sorted_count++] = tagged;
+    }
+    else {
+        data->sorted[data->sorted_count++] = str(&data->arena, path);
+    }
+}
+
+int sort__cmp(str_t a, str_t b, usize depth) {
+    usize len = MIN(a.len, b.len);
+    if (len > depth) {
+        int cmp = memcmp(a.buf + depth, b.buf + depth, len - depth);
+        if (cmp) return cmp;
+    }
+    return a.len < b.len ? -1 : a.len > b.len;
+}
+
+// 0 means the string ended, so shorter paths go before the ones they prefix
+static inline int sort__byte(str_t s, usize depth) {
+    return depth < s.len ? (u8)s.buf[depth] + 1 : 0;
+}
+
+void sort__insertion(str_t *items, usize count, usize depth) {
+    for (usize i = 1; i < count; ++i) {
+        str_t key = items[i];
+        usize k = i;
+        while (k > 0 && sort__cmp(items[k - 1], key, depth) > 0) {
+            items[k] = items[k - 1];
+            k--;
+        }
+        items[k] = key;
+    }
+}
+
+void sort__radix(str_t *items, str_t *tmp, usize count, usize depth) {
+    while (count > SORT_INSERTION_THRESHOLD) {
+        u32 counts[257] = {0};
+        for (usize i = 0; i < count; ++i) {
+            counts[sort__byte(items[i], depth)]++;
+        }
+
+        // paths in the same directory share long prefixes, walk over them
+        // without recursing when everything lands in the same bucket
+        int only = sort__byte(items[0], depth);
+        if (counts[only] == count) {
+            if (only == 0) return;
+            depth++;
+            continue;
+        }
+
+        u32 offsets[257];
+        u32 offset = 0;
+        for (int b = 0; b < 257; ++b) {
+            offsets[b] = offset;
+            offset += counts[b];
+        }
+        for (usize i = 0; i < count; ++i) {
+            tmp[offsets[sort__byte(items[i], depth)]++] = items[i];
+        }
+        memcpy(items, tmp, sizeof(str_t) * count);
+
+        // bucket 0 is all the same string, nothing to do there
+        usize start = counts[0];
+        for (int b = 1; b < 257; ++b) {
+            if (counts[b] > 1) {
+                sort__radix(items + start, tmp, counts[b], depth + 1);
+            }
+            start += counts[b];
+        }
+        return;
+    }
+
+    sort__insertion(items, count, depth);
+}
+
+void sorted_sort(worker_t *data) {
+    if (data->sorted_count < 2) return;
+    arena_t scratch = data->scratch;
+    str_t *tmp = alloc(&scratch, str_t, data->sorted_count);
+    sort__radix(data->sorted, tmp, data->sorted_count, 0);
+}
+
+typedef struct sortrun_t sortrun_t;
+struct sortrun_t {
+    str_t *cur;
+    str_t *end;
+};
+
+void sortrun__sift_down(sortrun_t *heap, int count, int i) {
+    while (true) {
+        int l = i * 2 + 1;
+        int r = l + 1;
+        int smallest = i;
+        if (l < count && sort__cmp(*heap[l].cur, *heap[smallest].cur, 0) < 0) smallest = l;
+        if (r < count && sort__cmp(*heap[r].cur, *heap[smallest].cur, 0) < 0) smallest = r;
+        if (smallest == i) break;
+        sortrun_t tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+void sorted_merge(worker_t *writer) {
+    sortrun_t heap[arrlen(workers)];
+    int count = 0;
+
+    for (int i = 0; i < opt.j; ++i) {
+        if (workers[i].sorted_count) {
+            heap[count++] = (sortrun_t){
+                .cur = workers[i].sorted,
+                .end = workers[i].sorted + workers[i].sorted_count,
+            };
+        }
+    }
+
+    for (int i = count / 2 - 1; i >= 0; --i) {
+        sortrun__sift_down(heap, count, i);
+    }
+
+    while (count > 0 && !ATOMIC_CHECK(output.closed)) {
+        strview_t line = strv(*heap[0].cur);
+        int pattern = -1;
+        const char *sep = memchr(line.buf, '\0', line.len);
+        if (sep) {
+            pattern = atoi(sep + 1);
+            line.len = sep - line.buf;
+        }
+        output_line(writer, line, pattern);
+        if (++heap[0].cur == heap[0].end) {
+            heap[0] = heap[--count];
+        }
+        sortrun__sift_down(heap, count, 0);
+    }
+
+    output_flush(writer);
+}
+
+// == JOB POOL ============
+//
+// job records die in a different order than they are born and usually on a
+// different worker, a record is freed by whoever drops the last reference.
+// they come out of a few size classes with the name in the same block, so a
+// recycled block always has room for the new name. each worker keeps a small
+// list of free blocks per class and takes and gives them without locking,
+// once a list gets too long a batch of POOL_BATCH blocks goes to the shared
+// list for that class, and a worker that runs out takes a whole batch back
+// before carving new blocks out of its slab. the memory used only ever grows
+// up to the most jobs alive at the same time, not with the size of the tree
+
+struct {
+    oshandle_t mtx;
+    poolblock_t *batches[POOL_CLASS_COUNT];
+    // stats, only touched with mtx held
+    u64 batches_given;
+    u64 batches_taken;
+} pool = {0};
+
+int pool__class(usize size) {
+    int cls = 0;
+    while (cls < POOL_CLASS_COUNT && ((usize)POOL_MIN_BLOCK << cls) < size) {
+        cls++;
+    }
+    if (cls == POOL_CLASS_COUNT) {
+        fatal("job of %zu bytes doesn't fit in the pool", size);
+    }
+    return cls;
+}
+
+void *pool_alloc(worker_t *data, int cls) {
+    poolcache_t *cache = &data->pool[cls];
+
+    if (!cache->head) {
+        os_mutex_lock(pool.mtx);
+        poolblock_t *batch = pool.batches[cls];
+        if (batch) {
+            pool.batches[cls] = batch->next_batch;
+            pool.batches_taken++;
+        }
+        os_mutex_unlock(pool.mtx);
+
+        if (batch) {
+            cache->head = batch;
+            cache->count = POOL_BATCH;
+        }
+    }
+
+    if (cache->head) {
+        poolblock_t *block = cache->head;
+        cache->head = block->next;
+        cache->count--;
+        data->pool_reused++;
+        return block;
+    }
+
+    usize size = (usize)POOL_MIN_BLOCK << cls;
+    if (data->slab_left < size) {
+        // whatever is left at the end of the old slab is too small for this class, let it go
+        data->slab = (u8 *)alloc(&data->arena, u64, POOL_SLAB_SIZE / sizeof(u64));
+        data->slab_left = POOL_SLAB_SIZE;
+        data->pool_slab_bytes += POOL_SLAB_SIZE;
+    }
+
+    void *block = data->slab;
+    data->slab += size;
+    data->slab_left -= size;
+    data->pool_carved++;
+    return block;
+}
+
+void pool_free(worker_t *data, void *ptr, int cls) {
+    poolcache_t *cache = &data->pool[cls];
+    poolblock_t *block = ptr;
+
+    block->next = cache->head;
+    cache->head = block;
+    cache->count++;
+
+    if (cache->count <= POOL_CACHE_MAX) {
+        return;
+    }
+
+    // hand the newest POOL_BATCH blocks over, they are the ones still in cache
+    poolblock_t *batch = cache->head;
+    poolblock_t *last = batch;
+    for (int i = 1; i < POOL_BATCH; ++i) {
+        last = last->next;
+    }
+    cache->head = last->next;
+    cache->count -= POOL_BATCH;
+    last->next = NULL;
+
+    os_mutex_lock(pool.mtx);
+        batch->next_batch = pool.batches[cls];
+        pool.batches[cls] = batch;
+        pool.batches_given++;
+    os_mutex_unlock(pool.mtx);
+}
+
+jobdata_t *jobdata_make(worker_t *data, jobdata_t *parent, strview_t name) {
+    int cls = pool__class(sizeof(jobdata_t) + name.len + 1);
+    jobdata_t *job = pool_alloc(data, cls);
+
+    char *buf = (char *)(job + 1);
+    memcpy(buf, name.buf, name.len);
+    buf[name.len] = '\0';
+
+    *job = (jobdata_t){
+        .parent = parent,
+        .name = { .buf = buf, .len = name.len },
+        .ignore = parent ? parent->ignore : NULL,
+        .open_refs = 1,
+        .refs = 1,
+        .pool_class = cls,
+        .volume = parent ? parent->volume : 0,
+        .depth = parent ? parent->depth + 1 : 0,
+    };
+
+    return job;
+}
+
+void jobdata_close(jobdata_t *job) {
+    if (ATOMIC_DEC(job->open_refs) == 0 && job->handle) {
+        CloseHandle(job->handle);
+        job->handle = NULL;
+    }
+}
+
+void jobdata_release(worker_t *data, jobdata_t *job) {
+    while (job && ATOMIC_DEC(job->refs) == 0) {
+        jobdata_t *parent = job->parent;
+        if (job->pool_class >= 0) {
+            pool_free(data, job, job->pool_class);
+        }
+        job = parent;
+    }
+}
+
+#ifndef NT_SUCCESS
+#define NT_SUCCESS(status) (((NTSTATUS)(status)) >= 0)
+#endif
+
+#ifndef FILE_OPEN_FOR_BACKUP_INTENT
+#define FILE_OPEN_FOR_BACKUP_INTENT 0x00004000
+#endif
+
+typedef NTSTATUS (NTAPI *nt_create_file_f)(
+    HANDLE *handle, 
+    DWORD access, 
+    OBJECT_ATTRIBUTES *attributes, 
+    IO_STATUS_BLOCK *status, 
+    LARGE_INTEGER *alloc_size, 
+    ULONG file_attributes, 
+    ULONG share, 
+    ULONG disposition, 
+    ULONG options, 
+    PVOID ea_buffer, 
+    ULONG ea_length
+);
+
+nt_create_file_f nt_create_file = NULL;
+
+WCHAR *path_to_wide(arena_t *arena, strview_t str) {
+    int wlen = MultiByteToWideChar(CP_UTF8, 0, str.buf, (int)str.len, NULL, 0);
+    WCHAR *wstr = alloc(arena, WCHAR, wlen + 1);
+    MultiByteToWideChar(CP_UTF8, 0, str.buf, (int)str.len, wstr, wlen);
+    wstr[wlen] = 0;
+    return wstr;
+}
+
+HANDLE handle__open_at(arena_t scratch, HANDLE parent, strview_t name, bool is_dir, bool overlapped) {
+    int wlen = MultiByteToWideChar(CP_UTF8, 0, name.buf, (int)name.len, NULL, 0);
+    WCHAR *wname = alloc(&scratch, WCHAR, wlen + 1);
+    MultiByteToWideChar(CP_UTF8, 0, name.buf, (int)name.len, wname, wlen);
+    wname[wlen] = 0;
+
+    // -L asks directory handles for their volume and file id, that needs read attributes
+    ACCESS_MASK access = is_dir ? FILE_LIST_DIRECTORY | FILE_READ_ATTRIBUTES : FILE_READ_DATA;
+
+    if (!parent) {
+        HANDLE handle = CreateFileW(
+            wname,
+            access,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            NULL,
+            OPEN_EXISTING,
+            (is_dir ? FILE_FLAG_BACKUP_SEMANTICS : 0) | (overlapped ? FILE_FLAG_OVERLAPPED : 0),
+            NULL
+        );
+        return handle == INVALID_HANDLE_VALUE ? NULL : handle;
+    }
+
+    UNICODE_STRING uname = {
+        .Length = (USHORT)(wlen * sizeof(WCHAR)),
+        .MaximumLength = (USHORT)(wlen * sizeof(WCHAR)),
+        .Buffer = wname,
+    };
+
+    OBJECT_ATTRIBUTES attr;
+    InitializeObjectAttributes(&attr, &uname, 0, parent, NULL);
+
+    IO_STATUS_BLOCK iosb = {0};
+    HANDLE handle = NULL;
+    NTSTATUS status = nt_create_file(
+        &handle,
+        access | (overlapped ? 0 : SYNCHRONIZE),
+        &attr,
+        &iosb,
+        NULL,
+        0,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        FILE_OPEN,
+        (is_dir ? FILE_DIRECTORY_FILE | FILE_OPEN_FOR_BACKUP_INTENT : FILE_NON_DIRECTORY_FILE) | (overlapped ? 0 : FILE_SYNCHRONOUS_IO_NONALERT),
+        NULL,
+        0
+    );
+
+    return NT_SUCCESS(status) ? handle : NULL;
+}
+
+HANDLE dir_open_at(arena_t scratch, HANDLE parent, strview_t name) {
+    return handle__open_at(scratch, parent, name, true, false);
+}
+
+// for the async walker, every read on it has to go through a completion port
+HANDLE dir_open_overlapped_at(arena_t scratch, HANDLE parent, strview_t name) {
+    return handle__open_at(scratch, parent, name, true, true);
+}
+
+HANDLE file_open_at(arena_t scratch, HANDLE parent, strview_t name) {
+    return handle__open_at(scratch, parent, name, false, false);
+}
+
+// == EXEC ================
+//
+// -x runs a command for every match, -X runs it with as many matches as fit
+// on one command line. the workers only copy the path into a bounded queue,
+// --exec-jobs launcher threads take them out and run the commands, so the
+// walk and the commands overlap and there are never more processes than
+// launchers. when the queue is full the workers wait, a slow command can't
+// make us hold the whole tree in memory. -X launchers wait for a full command
+// line worth of paths, for the walk to be over or for the queue to fill up
+// first, which happens with short names. otherwise the workers would wait for
+// the launchers and the launchers for more paths
+//
+// in the arguments {} is the path, {/} the name, {//} the parent directory,
+// {.} and {/.} the path and the name without extension. without any of them
+// the path goes at the end. paths get backslashes, so cmd builtins don't take
+// them for switches
+
+#define EXEC_QUEUE_CAP   4096
+#define EXEC_QUEUE_BYTES MB(1)
+// CreateProcess' limit in characters, with the terminator
+#define EXEC_CMDLINE_MAX 32767
+
+typedef struct execitem_t execitem_t;
+struct execitem_t {
+    usize offset;
+    usize len;
+    // bytes left unused at the end of the buffer to put this one at the start
+    usize skip;
+};
+
+struct {
+    oshandle_t mtx;
+    oshandle_t not_empty;
+    oshandle_t not_full;
+    oshandle_t launchers[64];
+    int launcher_count;
+    // paths live in a ring of bytes, items in a ring of their own
+    char *bytes;
+    usize bytes_used;
+    usize write_at;
+    execitem_t *items;
+    usize first;
+    usize count;
+    // -X, longest command line the queued paths could make
+    usize pending_len;
+    // workers waiting for room
+    int push_waiting;
+    bool closed;
+    // length of the arguments without placeholders, and how much the others
+    // add for a path of length 0 plus how many times they repeat the path
+    usize fixed_len;
+    usize path_len;
+    usize placeholders;
+    // stats, only touched with mtx held
+    u64 commands;
+    u64 paths;
+    u64 failed;
+    u64 full_waits;
+} exec = {0};
+
+const strview_t exec_placeholders[] = { cstrv("{}"), cstrv("{/}"), cstrv("{//}"), cstrv("{.}"), cstrv("{/.}") };
+
+usize exec__count_placeholders(strview_t arg) {
+    usize count = 0;
+    for (usize i = 0; i < arg.len; ++i) {
+        for (usize k = 0; k < arrlen(exec_placeholders); ++k) {
+            if (strv_starts_with_view(strv_sub(arg, i, SIZE_MAX), exec_placeholders[k])) {
+                count++;
+                break;
+            }
+        }
+    }
+    return count;
+}
+
+// upper bound, paths can't have quotes in them so quoting adds two characters at most
+usize exec__cost(strview_t path) {
+    return exec.path_len + exec.placeholders * path.len;
+}
+
+// windows command lines are split again by the child (CommandLineToArgvW rules)
+void exec__quote(outstream_t *out, strview_t arg) {
+    bool needs_quotes = arg.len == 0;
+    for (usize i = 0; i < arg.len && !needs_quotes; ++i) {
+        needs_quotes = arg.buf[i] == ' ' || arg.buf[i] == '\t' || arg.buf[i] == '"';
+    }
+
+    if (!needs_quotes) {
+        ostr_puts(out, arg);
+        return;
+    }
+
+    ostr_putc(out, '"');
+    usize slashes = 0;
+    for (usize i = 0; i < arg.len; ++i) {
+        char c = arg.buf[i];
+        if (c == '"') {
+            // the backslashes before a quote are doubled and the quote escaped
+            for (usize k = 0; k <= slashes; ++k) {
+                ostr_putc(out, '\\');
+            }
+        }
+        slashes = c == '\\' ? slashes + 1 : 0;
+        ostr_putc(out, c);
+    }
+    // same for the ones before the closing quote
+    for (usize k = 0; k < slashes; ++k) {
+        ostr_putc(out, '\\');
+    }
+    ostr_putc(out, '"');
+}
+
+void exec__expand(outstream_t *out, strview_t arg, strview_t path) {
+    usize slash = path.len;
+    while (slash > 0 && path.buf[slash - 1] != '\\') {
+        slash--;
+    }
+    strview_t name = strv_sub(path, slash, SIZE_MAX);
+    strview_t parent = slash ? strv_sub(path, 0, slash - 1) : strv(".");
+
+    // a leading dot is part of the name, not an extension
+    usize dot = name.len;
+    while (dot > 1 && name.buf[dot - 1] != '.') {
+        dot--;
+    }
+    usize ext_len = dot > 1 ? name.len - dot + 1 : 0;
+
+    for (usize i = 0; i < arg.len;) {
+        strview_t rest = strv_sub(arg, i, SIZE_MAX);
+        if      (strv_starts_with_view(rest, strv("{}")))   { ostr_puts(out, path); i += 2; }
+        else if (strv_starts_with_view(rest, strv("{/}")))  { ostr_puts(out, name); i += 3; }
+        else if (strv_starts_with_view(rest, strv("{//}"))) { ostr_puts(out, parent); i += 4; }
+        else if (strv_starts_with_view(rest, strv("{.}")))  { ostr_puts(out, strv_sub(path, 0, path.len - ext_len)); i += 3; }
+        else if (strv_starts_with_view(rest, strv("{/.}"))) { ostr_puts(out, strv_sub(name, 0, name.len - ext_len)); i += 4; }
+        else {
+            ostr_putc(out, arg.buf[i++]);
+        }
+    }
+}
+
+str_t exec__command_line(arena_t *arena, strview_t *paths, usize count) {
+    outstream_t out = ostr_init(arena);
+
+    for (int i = 0; i < opt.exec_count; ++i) {
+        strview_t arg = strv(opt.exec_args[i]);
+        if (!exec__count_placeholders(arg)) {
+            exec__quote(&out, arg);
+            ostr_putc(&out, ' ');
+            continue;
+        }
+
+        // -X repeats the argument for every path
+        for (usize k = 0; k < count; ++k) {
+            arena_t scratch = *arena;
+            outstream_t expanded = ostr_init(&scratch);
+            exec__expand(&expanded, arg, paths[k]);
+            exec__quote(&out, ostr_as_view(&expanded));
+            ostr_putc(&out, ' ');
+        }
+    }
+
+    str_t cmdline = ostr_to_str(&out);
+    cmdline.len--;
+    cmdline.buf[cmdline.len] = '\0';
+    return cmdline;
+}
+
+bool exec__run(arena_t scratch, strview_t cmdline) {
+    STARTUPINFOW startup = {
+        .cb = sizeof(startup),
+        .dwFlags = STARTF_USESTDHANDLES,
+        .hStdInput = GetStdHandle(STD_INPUT_HANDLE),
+        .hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE),
+        .hStdError = GetStdHandle(STD_ERROR_HANDLE),
+    };
+    PROCESS_INFORMATION process = {0};
+
+    if (!CreateProcessW(NULL, path_to_wide(&scratch, cmdline), NULL, NULL, TRUE, 0, NULL, NULL, &startup, &process)) {
+        warn("couldn't run %v: %v", cmdline, os_get_error_string(os_get_last_error()));
+        return false;
+    }
+
+    WaitForSingleObject(process.hProcess, INFINITE);
+    DWORD code = 1;
+    GetExitCodeProcess(process.hProcess, &code);
+    CloseHandle(process.hThread);
+    CloseHandle(process.hProcess);
+    return code == 0;
+}
+
+// any thread, waits while the queue is full
+void exec_push(strview_t path) {
+    os_mutex_lock(exec.mtx);
+
+    while (true) {
+        usize skip = (exec.write_at + path.len > EXEC_QUEUE_BYTES) ? EXEC_QUEUE_BYTES - exec.write_at : 0;
+        if (exec.count < EXEC_QUEUE_CAP && (exec.bytes_used + skip + path.len) <= EXEC_QUEUE_BYTES) {
+            usize offset = skip ? 0 : exec.write_at;
+            memcpy(exec.bytes + offset, path.buf, path.len);
+            // worker paths use forward slashes
+            for (usize i = 0; i < path.len; ++i) {
+                if (exec.bytes[offset + i] == '/') {
+                    exec.bytes[offset + i] = '\\';
+                }
+            }
+
+            exec.items[(exec.first + exec.count) % EXEC_QUEUE_CAP] = (execitem_t){ offset, path.len, skip };
+            exec.count++;
+            exec.write_at = offset + path.len;
+            exec.bytes_used += skip + path.len;
+            exec.pending_len += exec__cost(path);
+            break;
+        }
+
+        // a -X launcher might be waiting for a longer command line that can't come
+        exec.full_waits++;
+        exec.push_waiting++;
+        os_cond_signal(exec.not_empty);
+        os_cond_wait(exec.not_full, exec.mtx, OS_WAIT_INFINITE);
+        exec.push_waiting--;
+    }
+
+    // -X launchers only care once there's a whole command line
+    bool wake = !opt.exec_batch || (exec.fixed_len + exec.pending_len) >= EXEC_CMDLINE_MAX;
+    os_mutex_unlock(exec.mtx);
+
+    if (wake) {
+        os_cond_signal(exec.not_empty);
+    }
+}
+
+// mtx held, true when a launcher should take paths out now
+bool exec__ready(void) {
+    if (!exec.count) {
+        return false;
+    }
+    return !opt.exec_batch ||
+           exec.closed ||
+           exec.push_waiting > 0 ||
+           (exec.fixed_len + exec.pending_len) >= EXEC_CMDLINE_MAX;
+}
+
+// mtx held
+strview_t exec__pop(arena_t *arena) {
+    execitem_t item = exec.items[exec.first];
+    strview_t path = strv(str(arena, strv(exec.bytes + item.offset, item.len)));
+
+    exec.first = (exec.first + 1) % EXEC_QUEUE_CAP;
+    exec.count--;
+    exec.bytes_used -= item.skip + item.len;
+    exec.pending_len -= exec__cost(path);
+    if (!exec.count) {
+        exec.write_at = 0;
+        exec.bytes_used = 0;
+    }
+
+    return path;
+}
+
+int exec__launcher(u64 id, void *udata) {
+    COLLA_UNUSED(id);
+    COLLA_UNUSED(udata);
+
+    arena_t arena = arena_make(ARENA_VIRTUAL, GB(1));
+    strview_t *paths = alloc(&arena, strview_t, EXEC_CMDLINE_MAX / 2);
+
+    while (true) {
+        arena_t scratch = arena;
+        usize count = 0;
+
+        os_mutex_lock(exec.mtx);
+        while (!exec.closed && !exec__ready()) {
+            os_cond_wait(exec.not_empty, exec.mtx, OS_WAIT_INFINITE);
+        }
+
+        if (!exec.count) {
+            os_mutex_unlock(exec.mtx);
+            break;
+        }
+
+        if (opt.exec_batch) {
+            // always take one, even if it alone is too long for windows
+            usize len = exec.fixed_len;
+            do {
+                strview_t path = exec__pop(&scratch);
+                len += exec__cost(path);
+                paths[count++] = path;
+            } while (exec.count && (len + exec__cost(strv(exec.bytes + exec.items[exec.first].offset, exec.items[exec.first].len))) < EXEC_CMDLINE_MAX);
+        }
+        else {
+            paths[count++] = exec__pop(&scratch);
+        }
+
+        os_mutex_unlock(exec.mtx);
+        os_cond_broadcast(exec.not_full);
+
+        str_t cmdline = exec__command_line(&scratch, paths, count);
+        bool ok = exec__run(scratch, strv(cmdline));
+
+        os_mutex_lock(exec.mtx);
+            exec.commands++;
+            exec.paths += count;
+            exec.failed += !ok;
+        os_mutex_unlock(exec.mtx);
+    }
+
+    return 0;
+}
+
+void exec_start(arena_t *arena) {
+    exec.mtx = os_mutex_create();
+    exec.not_empty = os_cond_create();
+    exec.not_full = os_cond_create();
+    exec.bytes = alloc(arena, char, EXEC_QUEUE_BYTES);
+    exec.items = alloc(arena, execitem_t, EXEC_QUEUE_CAP);
+
+    bool has_placeholder = false;
+    for (int i = 0; i < opt.exec_count; ++i) {
+        has_placeholder |= exec__count_placeholders(strv(opt.exec_args[i])) > 0;
+    }
+    if (!has_placeholder) {
+        opt.exec_args[opt.exec_count++] = str(arena, "{}");
+    }
+
+    for (int i = 0; i < opt.exec_count; ++i) {
+        strview_t arg = strv(opt.exec_args[i]);
+        usize placeholders = exec__count_placeholders(arg);
+        // quotes and the space after it
+        if (placeholders) {
+            exec.path_len += arg.len + 3;
+            exec.placeholders += placeholders;
+        }
+        else {
+            exec.fixed_len += arg.len + 3;
+        }
+    }
+
+    int jobs = opt.exec_jobs ? opt.exec_jobs : opt.j;
+    exec.launcher_count = MIN(jobs, (int)arrlen(exec.launchers));
+    for (int i = 0; i < exec.launcher_count; ++i) {
+        exec.launchers[i] = os_thread_launch(exec__launcher, NULL);
+    }
+}
+
+// runs whatever is still queued, true if every command succeeded
+bool exec_finish(void) {
+    os_mutex_lock(exec.mtx);
+        exec.closed = true;
+    os_mutex_unlock(exec.mtx);
+    os_cond_broadcast(exec.not_empty);
+
+    for (int i = 0; i < exec.launcher_count; ++i) {
+        os_thread_join(exec.launchers[i], NULL);
+    }
+
+    return exec.failed == 0;
+}
+
+// == MATCHING ============
+//
+// the matcher is built once from opt.tofind and only ever read afterwards.
+// the needle is stored upper case when searching case insensitive and the
+// haystack gets folded inside the vector registers, so names are never copied.
+// candidates come from comparing the first and last byte of the needle at
+// every position at once, only those get a full compare
+
+typedef struct matcher_t matcher_t;
+struct matcher_t {
+    strview_t needle;
+    bool fold;
+    match_isa_e isa;
+    usize (*find)(const matcher_t *m, strview_t hay);
+};
+
+matcher_t matcher = {0};
+
+#if COLLA_MSVC
+#define MATCH_TARGET_AVX2
+#define MATCH_TARGET_XSAVE
+#else
+#define MATCH_TARGET_AVX2  __attribute__((target("avx2")))
+#define MATCH_TARGET_XSAVE __attribute__((target("xsave")))
+#endif
+
+static inline u32 match__ctz(u32 mask) {
+#if COLLA_MSVC
+    unsigned long index = 0;
+    _BitScanForward(&index, mask);
+    return (u32)index;
+#else
+    return (u32)__builtin_ctz(mask);
+#endif
+}
+
+static inline char match__fold(const matcher_t *m, char c) {
+    return m->fold && c >= 'a' && c <= 'z' ? c - ('a' - 'A') : c;
+}
+
+bool match__equals(const matcher_t *m, const char *at) {
+    for (usize i = 0; i < m->needle.len; ++i) {
+        if (match__fold(m, at[i]) != m->needle.buf[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+usize match__find_scalar_from(const matcher_t *m, strview_t hay, usize from) {
+    if (hay.len < m->needle.len) {
+        return STR_NONE;
+    }
+
+    for (usize i = from; i <= hay.len - m->needle.len; ++i) {
+        if (match__equals(m, hay.buf + i)) {
+            return i;
+        }
+    }
+
+    return STR_NONE;
+}
+
+usize match_find_scalar(const matcher_t *m, strview_t hay) {
+    return match__find_scalar_from(m, hay, 0);
+}
+
+static inline __m128i match__fold_sse2(const matcher_t *m, __m128i v) {
+    if (!m->fold) return v;
+    // bytes >= 0x80 are negative, so they never pass the 'a' check
+    __m128i ge_a = _mm_cmpgt_epi8(v, _mm_set1_epi8('a' - 1));
+    __m128i le_z = _mm_cmplt_epi8(v, _mm_set1_epi8('z' + 1));
+    __m128i lower = _mm_and_si128(ge_a, le_z);
+    return _mm_sub_epi8(v, _mm_and_si128(lower, _mm_set1_epi8('a' - 'A')));
+}
+
+usize match_find_sse2(const matcher_t *m, strview_t hay) {
+    usize n = m->needle.len;
+    if (n == 0) return 0;
+    if (hay.len < n) return STR_NONE;
+
+    const __m128i first = _mm_set1_epi8(m->needle.buf[0]);
+    const __m128i last  = _mm_set1_epi8(m->needle.buf[n - 1]);
+
+    // the last block gets copied in a zero padded buffer so we never read past the name,
+    // most names are shorter than a block so this is the common path
+    char tail[64];
+    usize positions = hay.len - n + 1;
+
+    for (usize i = 0; i < positions; i += 16) {
+        const char *block = hay.buf + i;
+        if (i + n - 1 + 16 > hay.len) {
+            usize rem = hay.len - i;
+            if (n - 1 + 16 > sizeof(tail)) {
+                return match__find_scalar_from(m, hay, i);
+            }
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, block, rem);
+            block = tail;
+        }
+
+        __m128i a = match__fold_sse2(m, _mm_loadu_si128((const __m128i *)block));
+        __m128i b = match__fold_sse2(m, _mm_loadu_si128((const __m128i *)(block + n - 1)));
+        u32 mask = (u32)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+
+        usize valid = positions - i;
+        if (valid < 16) {
+            mask &= (1u << valid) - 1;
+        }
+
+        while (mask) {
+            u32 bit = match__ctz(mask);
+            if (match__equals(m, block + bit)) {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    return STR_NONE;
+}
+
+MATCH_TARGET_AVX2
+static inline __m256i match__fold_avx2(const matcher_t *m, __m256i v) {
+    if (!m->fold) return v;
+    __m256i ge_a = _mm256_cmpgt_epi8(v, _mm256_set1_epi8('a' - 1));
+    __m256i le_z = _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), v);
+    __m256i lower = _mm256_and_si256(ge_a, le_z);
+    return _mm256_sub_epi8(v, _mm256_and_si256(lower, _mm256_set1_epi8('a' - 'A')));
+}
+
+MATCH_TARGET_AVX2
+usize match_find_avx2(const matcher_t *m, strview_t hay) {
+    usize n = m->needle.len;
+    if (n == 0) return 0;
+    if (hay.len < n) return STR_NONE;
+
+    const __m256i first = _mm256_set1_epi8(m->needle.buf[0]);
+    const __m256i last  = _mm256_set1_epi8(m->needle.buf[n - 1]);
+
+    char tail[96];
+    usize positions = hay.len - n + 1;
+
+    for (usize i = 0; i < positions; i += 32) {
+        const char *block = hay.buf + i;
+        if (i + n - 1 + 32 > hay.len) {
+            usize rem = hay.len - i;
+            if (n - 1 + 32 > sizeof(tail)) {
+                return match__find_scalar_from(m, hay, i);
+            }
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, block, rem);
+            block = tail;
+        }
+
+        __m256i a = match__fold_avx2(m, _mm256_loadu_si256((const __m256i *)block));
+        __m256i b = match__fold_avx2(m, _mm256_loadu_si256((const __m256i *)(block + n - 1)));
+        u32 mask = (u32)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+
+        usize valid = positions - i;
+        if (valid < 32) {
+            mask &= (1u << valid) - 1;
+        }
+
+        while (mask) {
+            u32 bit = match__ctz(mask);
+            if (match__equals(m, block + bit)) {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    return STR_NONE;
+}
+
+MATCH_TARGET_XSAVE
+match_isa_e match_detect_isa(void) {
+    int info[4] = {0};
+#if COLLA_MSVC
+    __cpuid(info, 1);
+#else
+    __cpuid(1, info[0], info[1], info[2], info[3]);
+#endif
+    bool osxsave = info[2] & (1 << 27);
+    bool avx = info[2] & (1 << 28);
+    if (!osxsave || !avx) {
+        return MATCH_ISA_SSE2;
+    }
+
+    // the os has to save the ymm registers as well
+    u64 xcr0 = _xgetbv(0);
+    if ((xcr0 & 6) != 6) {
+        return MATCH_ISA_SSE2;
+    }
+
+#if COLLA_MSVC
+    __cpuidex(info, 7, 0);
+#else
+    __cpuid_count(7, 0, info[0], info[1], info[2], info[3]);
+#endif
+    return info[1] & (1 << 5) ? MATCH_ISA_AVX2 : MATCH_ISA_SSE2;
+}
+
+matcher_t matcher_make(strview_t needle, bool fold, match_isa_e isa) {
+    matcher_t m = {
+        .needle = needle,
+        .fold = fold,
+        .isa = isa,
+    };
+
+    switch (isa) {
+        case MATCH_ISA_AVX2: m.find = match_find_avx2;   break;
+        case MATCH_ISA_SSE2: m.find = match_find_sse2;   break;
+        default:             m.find = match_find_scalar; break;
+    }
+
+    return m;
+}
+
+bool matcher_ends_with(const matcher_t *m, strview_t hay) {
+    if (hay.len < m->needle.len) {
+        return false;
+    }
+    return match__equals(m, hay.buf + hay.len - m->needle.len);
+}
+
+typedef struct match_t match_t;
+struct match_t {
+    usize index;
+    usize len;
+    // which of the patterns matched when searching for several at once
+    int pattern;
+};
+
+// -- glob ----------------------------------------- //
+//
+// braces are expanded at compile time, every alternative becomes its own
+// token list. the literal prefix and suffix of each alternative are pulled out
+// so most names get rejected by a length check and a couple of compares before
+// the token walk even starts. the compiled list is shared read only by all workers
+
+typedef enum {
+    GLOB_LITERAL,
+    GLOB_ANY,   // ?
+    GLOB_STAR,  // *
+    GLOB_SET,   // [...]
+} globtok_e;
+
+typedef struct globtok_t globtok_t;
+struct globtok_t {
+    globtok_e type;
+    strview_t literal;
+    u8 set[32];
+};
+
+typedef struct glob_t glob_t;
+struct glob_t {
+    strview_t prefix;
+    strview_t suffix;
+    usize min_len;
+    globtok_t *tokens;
+    int count;
+    glob_t *next;
+};
+
+glob_t *globs = NULL;
+
+glob_t *glob__compile_one(arena_t *arena, strview_t pattern) {
+    glob_t *g = alloc(arena, glob_t);
+    g->tokens = alloc(arena, globtok_t, pattern.len + 1);
+
+    usize i = 0;
+    while (i < pattern.len) {
+        globtok_t *tok = &g->tokens[g->count++];
+        char c = pattern.buf[i];
+
+        if (c == '*') {
+            tok->type = GLOB_STAR;
+            // a run of stars is the same as one
+            while (i < pattern.len && pattern.buf[i] == '*') ++i;
+        }
+        else if (c == '?') {
+            tok->type = GLOB_ANY;
+            g->min_len++;
+            ++i;
+        }
+        else if (c == '[') {
+            usize end = strv_find(pattern, ']', i + 2);
+            if (end == STR_NONE) {
+                options_fatal("unterminated [ in glob pattern (%v)", pattern);
+            }
+
+            tok->type = GLOB_SET;
+            usize k = i + 1;
+            bool negate = pattern.buf[k] == '!' || pattern.buf[k] == '^';
+            if (negate) ++k;
+
+            for (; k < end; ++k) {
+                u8 from = (u8)pattern.buf[k];
+                u8 to = from;
+                if ((k + 2) < end && pattern.buf[k + 1] == '-') {
+                    to = (u8)pattern.buf[k + 2];
+                    k += 2;
+                }
+                for (u32 ch = from; ch <= to; ++ch) {
+                    tok->set[ch >> 3] |= 1 << (ch & 7);
+                }
+            }
+
+            if (negate) {
+                for (int b = 0; b < arrlen(tok->set); ++b) {
+                    tok->set[b] = ~tok->set[b];
+                }
+            }
+
+            g->min_len++;
+            i = end + 1;
+        }
+        else {
+            usize end = strv_find_either(pattern, strv("*?["), i);
+            if (end == STR_NONE) end = pattern.len;
+            tok->type = GLOB_LITERAL;
+            tok->literal = strv_sub(pattern, i, end);
+            g->min_len += tok->literal.len;
+            i = end;
+        }
+    }
+
+    if (g->count && g->tokens[0].type == GLOB_LITERAL) {
+        g->prefix = g->tokens[0].literal;
+    }
+    if (g->count && g->tokens[g->count - 1].type == GLOB_LITERAL) {
+        g->suffix = g->tokens[g->count - 1].literal;
+    }
+
+    return g;
+}
+
+void glob__expand(arena_t *arena, strview_t pattern, glob_t **list) {
+    usize open = strv_find(pattern, '{', 0);
+    if (open == STR_NONE) {
+        glob_t *g = glob__compile_one(arena, pattern);
+        g->next = *list;
+        *list = g;
+        return;
+    }
+
+    // find the matching brace and split the top level commas
+    int depth = 0;
+    usize close = STR_NONE;
+    for (usize i = open; i < pattern.len; ++i) {
+        if (pattern.buf[i] == '{') depth++;
+        else if (pattern.buf[i] == '}' && --depth == 0) {
+            close = i;
+            break;
+        }
+    }
+
+    if (close == STR_NONE) {
+        options_fatal("unterminated { in glob pattern (%v)", pattern);
+    }
+
+    strview_t before = strv_sub(pattern, 0, open);
+    strview_t after = strv_sub(pattern, close + 1, SIZE_MAX);
+
+    usize alt_begin = open + 1;
+    depth = 0;
+    for (usize i = open + 1; i <= close; ++i) {
+        char c = pattern.buf[i];
+        if (c == '{') depth++;
+        else if (c == '}' && i != close) depth--;
+        else if ((c == ',' && depth == 0) || i == close) {
+            strview_t alt = strv_sub(pattern, alt_begin, i);
+            str_t expanded = str_fmt(arena, "%v%v%v", before, alt, after);
+            glob__expand(arena, strv(expanded), list);
+            alt_begin = i + 1;
+        }
+    }
+}
+
+glob_t *glob_compile(arena_t *arena, strview_t pattern) {
+    glob_t *list = NULL;
+    glob__expand(arena, pattern, &list);
+    return list;
+}
+
+bool glob__literal_equals(strview_t literal, const char *at, bool fold) {
+    for (usize i = 0; i < literal.len; ++i) {
+        char c = at[i];
+        if (fold && c >= 'a' && c <= 'z') c -= 'a' - 'A';
+        if (c != literal.buf[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool glob__match_one(const glob_t *g, strview_t name, bool fold) {
+    if (name.len < g->min_len) {
+        return false;
+    }
+
+    if (g->prefix.len && !glob__literal_equals(g->prefix, name.buf, fold)) {
+        return false;
+    }
+
+    if (g->suffix.len && !glob__literal_equals(g->suffix, name.buf + name.len - g->suffix.len, fold)) {
+        return false;
+    }
+
+    // usual glob walk, on a mismatch go back to the last star and let it eat one more char
+    int t = 0;
+    usize i = 0;
+    int star_tok = -1;
+    usize star_pos = 0;
+
+    while (i < name.len || t < g->count) {
+        if (t < g->count) {
+            const globtok_t *tok = &g->tokens[t];
+            char c = i < name.len ? name.buf[i] : 0;
+            if (fold && c >= 'a' && c <= 'z') c -= 'a' - 'A';
+
+            switch (tok->type) {
+                case GLOB_STAR:
+                    star_tok = t++;
+                    star_pos = i;
+                    continue;
+                case GLOB_ANY:
+                    if (i < name.len) {
+                        ++i, ++t;
+                        continue;
+                    }
+                    break;
+                case GLOB_SET:
+                    if (i < name.len && (tok->set[(u8)c >> 3] & (1 << ((u8)c & 7)))) {
+                        ++i, ++t;
+                        continue;
+                    }
+                    break;
+                case GLOB_LITERAL:
+                    if ((i + tok->literal.len) <= name.len && glob__literal_equals(tok->literal, name.buf + i, fold)) {
+                        i += tok->literal.len;
+                        ++t;
+                        continue;
+                    }
+                    break;
+            }
+        }
+
+        if (star_tok >= 0 && star_pos < name.len) {
+            i = ++star_pos;
+            t = star_tok + 1;
+            continue;
+        }
+
+        return false;
+    }
+
+    return true;
+}
+
+bool glob_match(const glob_t *list, strview_t name, bool fold) {
+    for (const glob_t *g = list; g; g = g->next) {
+        if (glob__match_one(g, name, fold)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// -- regex ---------------------------------------- //
+//
+// the expression is compiled to a thompson nfa once at startup and shared by
+// everyone. every worker then builds its own dfa on top of it lazily, one state
+// per set of nfa states actually reached, so matching is always linear in the
+// length of the name and a nasty pattern can't make us backtrack. the dfa cache
+// is capped, when it fills up it gets thrown away and rebuilt from scratch.
+// the longest literal that every match must contain is pulled out while parsing
+// and runs through the simd matcher first, so most names never reach the dfa.
+// supports . [] [^] * + ? {n,m} | () \d \w \s ^ and $. the anchors are states
+// of their own, so each alternative in ^a|b$ keeps its own
+// counted repetitions are expanded into copies, a pattern that grows past
+// REGEX_MAX_STATES is refused instead of taking forever to compile
+
+#define REGEX_MAX_STATES 16384
+
+typedef enum {
+    RE_CHAR,
+    RE_SPLIT,
+    RE_EMPTY,
+    // only passable before the first character
+    RE_BEGIN,
+    // only passable after the last character
+    RE_END,
+    RE_MATCH,
+} restate_e;
+
+typedef struct restate_t restate_t;
+struct restate_t {
+    restate_e type;
+    int out;
+    int out1;
+    u8 set[32];
+};
+
+typedef struct regex_t regex_t;
+struct regex_t {
+    restate_t *states;
+    int count;
+    int start;
+    matcher_t prefilter;
+};
+
+regex_t regex = {0};
+
+typedef struct refrag_t refrag_t;
+struct refrag_t {
+    int start;
+    int end;
+};
+
+typedef struct reparser_t reparser_t;
+struct reparser_t {
+    arena_t *arena;
+    strview_t src;
+    usize cur;
+    bool fold;
+    regex_t *re;
+    int cap;
+    int depth;
+    // longest run of plain characters at the top level
+    char run[256];
+    usize run_len;
+    char best[256];
+    usize best_len;
+    bool has_alternation;
+};
+
+int re__add(reparser_t *p, restate_e type) {
+    if (p->re->count >= REGEX_MAX_STATES) {
+        options_fatal("regex is too big once its repetitions are expanded (%v)", p->src);
+    }
+    if (p->re->count >= p->cap) {
+        int newcap = MIN(p->cap * 2, REGEX_MAX_STATES);
+        restate_t *states = alloc(p->arena, restate_t, newcap);
+        memcpy(states, p->re->states, sizeof(restate_t) * p->re->count);
+        p->re->states = states;
+        p->cap = newcap;
+    }
+    int id = p->re->count++;
+    restate_t *s = &p->re->states[id];
+    memset(s, 0, sizeof(*s));
+    s->type = type;
+    s->out = s->out1 = -1;
+    return id;
+}
+
+void re__patch(reparser_t *p, int end, int to) {
+    p->re->states[end].out = to;
+}
+
+static inline void re__set_add(u8 *set, u8 c) {
+    set[c >> 3] |= 1 << (c & 7);
+}
+
+static inline bool re__set_has(const u8 *set, u8 c) {
+    return set[c >> 3] & (1 << (c & 7));
+}
+
+void re__set_class(u8 *set, char cls) {
+    switch (cls) {
+        case 'd': case 'D':
+            for (u8 c = '0'; c <= '9'; ++c) re__set_add(set, c);
+            break;
+        case 'w': case 'W':
+            for (u8 c = '0'; c <= '9'; ++c) re__set_add(set, c);
+            for (u8 c = 'a'; c <= 'z'; ++c) re__set_add(set, c);
+            for (u8 c = 'A'; c <= 'Z'; ++c) re__set_add(set, c);
+            re__set_add(set, '_');
+            break;
+        case 's': case 'S':
+            re__set_add(set, ' ');
+            re__set_add(set, '\t');
+            break;
+    }
+    if (cls >= 'A' && cls <= 'Z') {
+        for (int i = 0; i < 32; ++i) set[i] = ~set[i];
+    }
+}
+
+bool re__is_class(char c) {
+    return c == 'd' || c == 'D' || c == 'w' || c == 'W' || c == 's' || c == 'S';
+}
+
+void re__set_fold(u8 *set) {
+    for (u8 c = 'a'; c <= 'z'; ++c) {
+        u8 up = c - ('a' - 'A');
+        if (re__set_has(set, c) || re__set_has(set, up)) {
+            re__set_add(set, c);
+            re__set_add(set, up);
+        }
+    }
+}
+
+refrag_t re__parse_alt(reparser_t *p);
+
+bool re__peek_is(reparser_t *p, char c) {
+    return p->cur < p->src.len && p->src.buf[p->cur] == c;
+}
+
+// returns the single character the atom matches, or 0 if it matches more than that
+char re__parse_atom(reparser_t *p, refrag_t *frag) {
+    char c = p->src.buf[p->cur++];
+    char literal = 0;
+
+    if (c == '(') {
+        p->depth++;
+        *frag = re__parse_alt(p);
+        p->depth--;
+        if (!re__peek_is(p, ')')) {
+            options_fatal("missing ) in regex (%v)", p->src);
+        }
+        p->cur++;
+        return 0;
+    }
+
+    int id = re__add(p, RE_CHAR);
+    u8 *set = p->re->states[id].set;
+
+    if (c == '.') {
+        memset(set, 0xff, 32);
+    }
+    else if (c == '[') {
+        bool negate = re__peek_is(p, '^');
+        if (negate) p->cur++;
+
+        bool first = true;
+        while (p->cur < p->src.len && (first || p->src.buf[p->cur] != ']')) {
+            first = false;
+            u8 from = (u8)p->src.buf[p->cur++];
+            if (from == '\\' && p->cur < p->src.len) {
+                char esc = p->src.buf[p->cur++];
+                if (re__is_class(esc)) {
+                    re__set_class(set, esc);
+                    continue;
+                }
+                from = (u8)esc;
+            }
+            u8 to = from;
+            if ((p->cur + 1) < p->src.len && p->src.buf[p->cur] == '-' && p->src.buf[p->cur + 1] != ']') {
+                to = (u8)p->src.buf[p->cur + 1];
+                p->cur += 2;
+            }
+            for (u32 ch = from; ch <= to; ++ch) {
+                re__set_add(set, (u8)ch);
+            }
+        }
+
+        if (!re__peek_is(p, ']')) {
+            options_fatal("missing ] in regex (%v)", p->src);
+        }
+        p->cur++;
+
+        if (p->fold) re__set_fold(set);
+        if (negate) {
+            for (int i = 0; i < 32; ++i) set[i] = ~set[i];
+        }
+    }
+    else {
+        if (c == '\\') {
+            if (p->cur >= p->src.len) {
+                options_fatal("trailing \\ in regex (%v)", p->src);
+            }
+            c = p->src.buf[p->cur++];
+            if (re__is_class(c)) {
+                re__set_class(set, c);
+                c = 0;
+            }
+        }
+        else if (c == '^' || c == '$') {
+            p->re->states[id].type = c == '^' ? RE_BEGIN : RE_END;
+            *frag = (refrag_t){ id, id };
+            return 0;
+        }
+        else if (c == ')' || c == '*' || c == '+' || c == '?' || c == '{') {
+            options_fatal("unexpected '%c' in regex (%v)", c, p->src);
+        }
+
+        if (c) {
+            re__set_add(set, (u8)c);
+            if (p->fold) re__set_fold(set);
+            literal = c;
+        }
+    }
+
+    *frag = (refrag_t){ id, id };
+    return literal;
+}
+
+bool re__parse_count(reparser_t *p, int *min, int *max) {
+    // {n}, {n,} or {n,m}
+    instream_t in = istr_init(strv_remove_prefix(p->src, p->cur + 1));
+    u64 lo = 0, hi = 0;
+    if (!istr_get_u64(&in, &lo)) return false;
+    hi = lo;
+    if (istr_peek(&in) == ',') {
+        istr_skip(&in, 1);
+        if (istr_peek(&in) == '}') hi = 0xffff;
+        else if (!istr_get_u64(&in, &hi)) return false;
+    }
+    if (istr_get(&in) != '}' || hi < lo || lo > 1000 || (hi != 0xffff && hi > 1000)) {
+        options_fatal("invalid repetition in regex (%v)", p->src);
+    }
+    p->cur += 1 + istr_tell(&in);
+    *min = (int)lo;
+    *max = hi == 0xffff ? -1 : (int)hi;
+    return true;
+}
+
+refrag_t re__empty(reparser_t *p) {
+    int id = re__add(p, RE_EMPTY);
+    return (refrag_t){ id, id };
+}
+
+refrag_t re__cat(reparser_t *p, refrag_t a, refrag_t b) {
+    if (a.start < 0) return b;
+    re__patch(p, a.end, b.start);
+    return (refrag_t){ a.start, b.end };
+}
+
+refrag_t re__quest(reparser_t *p, refrag_t a) {
+    int split = re__add(p, RE_SPLIT);
+    int end = re__add(p, RE_EMPTY);
+    p->re->states[split].out = a.start;
+    p->re->states[split].out1 = end;
+    re__patch(p, a.end, end);
+    return (refrag_t){ split, end };
+}
+
+refrag_t re__star(reparser_t *p, refrag_t a) {
+    int split = re__add(p, RE_SPLIT);
+    int end = re__add(p, RE_EMPTY);
+    p->re->states[split].out = a.start;
+    p->re->states[split].out1 = end;
+    re__patch(p, a.end, split);
+    return (refrag_t){ split, end };
+}
+
+refrag_t re__plus(reparser_t *p, refrag_t a) {
+    int split = re__add(p, RE_SPLIT);
+    int end = re__add(p, RE_EMPTY);
+    p->re->states[split].out = a.start;
+    p->re->states[split].out1 = end;
+    re__patch(p, a.end, split);
+    return (refrag_t){ a.start, end };
+}
+
+void re__end_run(reparser_t *p) {
+    if (p->run_len > p->best_len) {
+        memcpy(p->best, p->run, p->run_len);
+        p->best_len = p->run_len;
+    }
+    p->run_len = 0;
+}
+
+refrag_t re__parse_cat(reparser_t *p) {
+    refrag_t frag = { -1, -1 };
+
+    while (p->cur < p->src.len && !re__peek_is(p, '|') && !re__peek_is(p, ')')) {
+        usize atom_begin = p->cur;
+        refrag_t atom;
+        char literal = re__parse_atom(p, &atom);
+        usize atom_end = p->cur;
+
+        int min = 1, max = 1;
+        if (re__peek_is(p, '*'))      { min = 0; max = -1; p->cur++; }
+        else if (re__peek_is(p, '+')) { min = 1; max = -1; p->cur++; }
+        else if (re__peek_is(p, '?')) { min = 0; max = 1;  p->cur++; }
+        else if (re__peek_is(p, '{') && !re__parse_count(p, &min, &max)) {
+            options_fatal("invalid repetition in regex (%v)", p->src);
+        }
+
+        // lazy quantifiers don't change whether something matches
+        if ((min != 1 || max != 1) && re__peek_is(p, '?')) {
+            p->cur++;
+        }
+
+        if (p->depth == 0 && literal && min == 1 && max == 1 && p->run_len < arrlen(p->run)) {
+            p->run[p->run_len++] = p->fold ? char_upper(literal) : literal;
+        }
+        else if (p->depth == 0) {
+            re__end_run(p);
+        }
+
+        if (min == 1 && max == 1) {
+            frag = re__cat(p, frag, atom);
+            continue;
+        }
+
+        // counted repetitions are expanded by parsing the atom again, every pass
+        // through re__parse_atom emits a fresh copy of its states
+        usize after = p->cur;
+        refrag_t rep = { -1, -1 };
+        int copies = max < 0 ? MAX(min, 1) : max;
+
+        for (int i = 0; i < copies; ++i) {
+            refrag_t copy = atom;
+            if (i > 0) {
+                p->cur = atom_begin;
+                p->depth++;
+                re__parse_atom(p, &copy);
+                p->depth--;
+                colla_assert(p->cur == atom_end);
+            }
+
+            if (max < 0 && i == copies - 1) {
+                copy = min == 0 ? re__star(p, copy) : re__plus(p, copy);
+            }
+            else if (i >= min) {
+                copy = re__quest(p, copy);
+            }
+
+            rep = re__cat(p, rep, copy);
+        }
+        p->cur = after;
+
+        frag = re__cat(p, frag, rep.start < 0 ? re__empty(p) : rep);
+    }
+
+    if (p->depth == 0) {
+        re__end_run(p);
+    }
+
+    return frag.start < 0 ? re__empty(p) : frag;
+}
+
+refrag_t re__parse_alt(reparser_t *p) {
+    refrag_t left = re__parse_cat(p);
+
+    while (re__peek_is(p, '|')) {
+        p->cur++;
+        if (p->depth == 0) {
+            p->has_alternation = true;
+        }
+        refrag_t right = re__parse_cat(p);
+
+        int split = re__add(p, RE_SPLIT);
+        int end = re__add(p, RE_EMPTY);
+        p->re->states[split].out = left.start;
+        p->re->states[split].out1 = right.start;
+        re__patch(p, left.end, end);
+        re__patch(p, right.end, end);
+        left = (refrag_t){ split, end };
+    }
+
+    return left;
+}
+
+regex_t regex_compile(arena_t *arena, strview_t pattern, bool fold, match_isa_e isa) {
+    regex_t re = {0};
+
+    reparser_t *p = alloc(arena, reparser_t);
+    p->arena = arena;
+    p->src = pattern;
+    p->fold = fold;
+    p->re = &re;
+    p->cap = (int)pattern.len * 4 + 8;
+    re.states = alloc(arena, restate_t, p->cap);
+
+    refrag_t frag = re__parse_alt(p);
+    if (p->cur < p->src.len) {
+        options_fatal("unbalanced ) in regex (%v)", pattern);
+    }
+
+    int match = re__add(p, RE_MATCH);
+    re__patch(p, frag.end, match);
+    re.start = frag.start;
+
+    if (!p->has_alternation && p->best_len) {
+        str_t literal = str(arena, strv(p->best, p->best_len));
+        re.prefilter = matcher_make(strv(literal), fold, isa);
+    }
+
+    return re;
+}
+
+// -- lazy dfa ------------------------------------- //
+
+#define DFA_MAX_STATES 2048
+#define DFA_DEAD  -2
+#define DFA_UNSET -1
+
+typedef struct dfastate_t dfastate_t;
+struct dfastate_t {
+    int *nfa;
+    int count;
+    // matches here, whatever comes next
+    bool match;
+    // matches only if the name ends here, through a $
+    bool match_end;
+    u64 hash;
+    i32 next[256];
+};
+
+typedef struct dfa_t dfa_t;
+struct dfa_t {
+    arena_t arena;
+    dfastate_t **states;
+    int count;
+    i32 *table;
+    int table_mask;
+    i32 start;
+    // scratch for building sets, sized to the nfa
+    int *stack;
+    int *set;
+    u32 *mark;
+    u32 gen;
+    // survives a flush, holds the state we were in
+    int *saved;
+    u64 flushes;
+};
+
+void dfa__reset(dfa_t *dfa) {
+    arena_rewind(&dfa->arena, 0);
+    dfa->states = alloc(&dfa->arena, dfastate_t *, DFA_MAX_STATES);
+    dfa->table_mask = DFA_MAX_STATES * 2 - 1;
+    dfa->table = alloc(&dfa->arena, i32, dfa->table_mask + 1);
+    memset(dfa->table, 0xff, sizeof(i32) * (dfa->table_mask + 1));
+    dfa->count = 0;
+    dfa->start = DFA_UNSET;
+    dfa->stack = alloc(&dfa->arena, int, regex.count);
+    dfa->set = alloc(&dfa->arena, int, regex.count);
+    dfa->mark = alloc(&dfa->arena, u32, regex.count);
+    dfa->gen = 0;
+}
+
+dfa_t *dfa_make(arena_t *arena) {
+    dfa_t *dfa = alloc(arena, dfa_t);
+    dfa->arena = arena_make(ARENA_VIRTUAL, GB(1));
+    dfa->saved = alloc(arena, int, regex.count);
+    dfa__reset(dfa);
+    return dfa;
+}
+
+// the rest of the dfa lives in the arena it was made with
+void dfa_free(dfa_t *dfa) {
+    arena_cleanup(&dfa->arena);
+}
+
+// adds the epsilon closure of state to dfa->set, ^ only lets us through
+// before the first character. $ can't be decided yet so it goes in the set
+void dfa__closure(dfa_t *dfa, int state, bool at_begin, int *count) {
+    int top = 0;
+    dfa->stack[top++] = state;
+
+    while (top > 0) {
+        int id = dfa->stack[--top];
+        if (id < 0 || dfa->mark[id] == dfa->gen) continue;
+        dfa->mark[id] = dfa->gen;
+
+        restate_t *s = &regex.states[id];
+        switch (s->type) {
+            case RE_SPLIT:
+                dfa->stack[top++] = s->out1;
+                dfa->stack[top++] = s->out;
+                break;
+            case RE_EMPTY:
+                dfa->stack[top++] = s->out;
+                break;
+            case RE_BEGIN:
+                if (at_begin) dfa->stack[top++] = s->out;
+                break;
+            default:
+                dfa->set[(*count)++] = id;
+                break;
+        }
+    }
+}
+
+// whether any of the $ in the set leads to a match once there's nothing left
+bool dfa__match_at_end(dfa_t *dfa, const int *nfa, int count) {
+    int top = 0;
+    dfa->gen++;
+    for (int i = 0; i < count; ++i) {
+        if (regex.states[nfa[i]].type == RE_END) {
+            dfa->stack[top++] = nfa[i];
+        }
+    }
+
+    while (top > 0) {
+        int id = dfa->stack[--top];
+        if (id < 0 || dfa->mark[id] == dfa->gen) continue;
+        dfa->mark[id] = dfa->gen;
+
+        restate_t *s = &regex.states[id];
+        switch (s->type) {
+            case RE_SPLIT:
+                dfa->stack[top++] = s->out1;
+                dfa->stack[top++] = s->out;
+                break;
+            case RE_EMPTY:
+            case RE_END:
+                dfa->stack[top++] = s->out;
+                break;
+            case RE_MATCH:
+                return true;
+            default:
+                break;
+        }
+    }
+
+    return false;
+}
+
+int dfa__cmp_int(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+// returns the index of the state for dfa->set[0..count), creating it if needed
+i32 dfa__intern(dfa_t *dfa, int count) {
+    // every step starts the whole regex over, if not even that survives
+    // nothing ever will
+    if (count == 0) {
+        return DFA_DEAD;
+    }
+
+    qsort(dfa->set, count, sizeof(int), dfa__cmp_int);
+
+    u64 hash = 0xcbf29ce484222325ull;
+    for (int i = 0; i < count; ++i) {
+        hash = (hash ^ (u64)dfa->set[i]) * 0x100000001b3ull;
+    }
+
+    u32 slot = (u32)hash & dfa->table_mask;
+    while (dfa->table[slot] >= 0) {
+        dfastate_t *st = dfa->states[dfa->table[slot]];
+        if (st->hash == hash && st->count == count && memcmp(st->nfa, dfa->set, sizeof(int) * count) == 0) {
+            return dfa->table[slot];
+        }
+        slot = (slot + 1) & dfa->table_mask;
+    }
+
+    dfastate_t *st = alloc(&dfa->arena, dfastate_t);
+    st->nfa = alloc(&dfa->arena, int, count + 1);
+    memcpy(st->nfa, dfa->set, sizeof(int) * count);
+    st->count = count;
+    st->hash = hash;
+    memset(st->next, 0xff, sizeof(st->next));
+
+    for (int i = 0; i < count; ++i) {
+        if (regex.states[st->nfa[i]].type == RE_MATCH) {
+            st->match = true;
+        }
+    }
+    st->match_end = st->match || dfa__match_at_end(dfa, st->nfa, count);
+
+    i32 index = dfa->count++;
+    dfa->states[index] = st;
+    dfa->table[slot] = index;
+    return index;
+}
+
+i32 dfa__start(dfa_t *dfa) {
+    if (dfa->start == DFA_UNSET) {
+        int count = 0;
+        dfa->gen++;
+        dfa__closure(dfa, regex.start, true, &count);
+        dfa->start = dfa__intern(dfa, count);
+    }
+    return dfa->start;
+}
+
+i32 dfa__step(dfa_t *dfa, i32 from, u8 c) {
+    if (dfa->count >= DFA_MAX_STATES - 1) {
+        // cache is full, throw it away but keep the state we are in
+        dfastate_t *cur = dfa->states[from];
+        int count = cur->count;
+        memcpy(dfa->saved, cur->nfa, sizeof(int) * count);
+
+        dfa__reset(dfa);
+        dfa->flushes++;
+        memcpy(dfa->set, dfa->saved, sizeof(int) * count);
+        from = dfa__intern(dfa, count);
+    }
+
+    dfastate_t *st = dfa->states[from];
+    int count = 0;
+    dfa->gen++;
+
+    for (int i = 0; i < st->count; ++i) {
+        restate_t *s = &regex.states[st->nfa[i]];
+        if (s->type == RE_CHAR && re__set_has(s->set, c)) {
+            dfa__closure(dfa, s->out, false, &count);
+        }
+    }
+
+    // unanchored search, a match can start at any position. alternatives
+    // that begin with ^ stop at their anchor
+    dfa__closure(dfa, regex.start, false, &count);
+
+    i32 to = dfa__intern(dfa, count);
+    // the state might have moved if the cache got flushed above
+    dfa->states[from]->next[c] = to;
+    return to;
+}
+
+bool regex_match(dfa_t *dfa, strview_t name) {
+    i32 state = dfa__start(dfa);
+    if (state == DFA_DEAD) {
+        return false;
+    }
+
+    if (dfa->states[state]->match) {
+        return true;
+    }
+
+    for (usize i = 0; i < name.len; ++i) {
+        u8 c = (u8)name.buf[i];
+        i32 next = dfa->states[state]->next[c];
+        if (next == DFA_UNSET) {
+            next = dfa__step(dfa, state, c);
+        }
+        if (next == DFA_DEAD) {
+            return false;
+        }
+        state = next;
+        if (dfa->states[state]->match) {
+            return true;
+        }
+    }
+
+    return dfa->states[state]->match_end;
+}
+
+// -- multiple patterns ---------------------------- //
+//
+// all the names are put in one aho-corasick automaton so a single pass over
+// the file name finds whichever of them shows up first. the transitions are
+// fully expanded (no failure links to chase while matching) and case folding
+// is baked into the table, lower case letters just jump where upper case ones do
+
+typedef struct acstate_t acstate_t;
+struct acstate_t {
+    i32 next[256];
+    i32 fail;
+    // pattern that ends here, or -1
+    i32 out;
+    // closest state down the failure chain that has an output, or -1
+    i32 dict;
+};
+
+typedef struct aho_t aho_t;
+struct aho_t {
+    acstate_t *states;
+    int count;
+    usize *lens;
+    int pattern_count;
+};
+
+aho_t aho = {0};
+
+int aho__add_state(aho_t *ac) {
+    int id = ac->count++;
+    acstate_t *st = &ac->states[id];
+    memset(st->next, 0xff, sizeof(st->next));
+    st->fail = 0;
+    st->out = -1;
+    st->dict = -1;
+    return id;
+}
+
+aho_t aho_compile(arena_t *arena, str_t *patterns, int count, bool fold) {
+    aho_t ac = {0};
+
+    usize total = 1;
+    for (int i = 0; i < count; ++i) {
+        total += patterns[i].len;
+    }
+
+    ac.states = alloc(arena, acstate_t, total);
+    ac.lens = alloc(arena, usize, count);
+    ac.pattern_count = count;
+    aho__add_state(&ac);
+
+    for (int i = 0; i < count; ++i) {
+        int cur = 0;
+        for (usize k = 0; k < patterns[i].len; ++k) {
+            char c = patterns[i].buf[k];
+            u8 key = (u8)(fold ? char_upper(c) : c);
+            if (ac.states[cur].next[key] < 0) {
+                int id = aho__add_state(&ac);
+                ac.states[cur].next[key] = id;
+            }
+            cur = ac.states[cur].next[key];
+        }
+        // with duplicates the first one wins
+        if (ac.states[cur].out < 0) {
+            ac.states[cur].out = i;
+        }
+        ac.lens[i] = patterns[i].len;
+    }
+
+    // breadth first so the failure state of a node is always done before the node itself
+    int *queue = alloc(arena, int, ac.count);
+    int head = 0, tail = 0;
+    queue[tail++] = 0;
+
+    while (head < tail) {
+        int u = queue[head++];
+        acstate_t *su = &ac.states[u];
+
+        for (int c = 0; c < 256; ++c) {
+            int v = su->next[c];
+            if (v > 0) {
+                acstate_t *sv = &ac.states[v];
+                sv->fail = u == 0 ? 0 : ac.states[su->fail].next[c];
+                acstate_t *sf = &ac.states[sv->fail];
+                sv->dict = sf->out >= 0 ? sv->fail : sf->dict;
+                queue[tail++] = v;
+            }
+            else {
+                su->next[c] = u == 0 ? 0 : ac.states[su->fail].next[c];
+            }
+        }
+    }
+
+    if (fold) {
+        for (int i = 0; i < ac.count; ++i) {
+            for (int c = 'a'; c <= 'z'; ++c) {
+                ac.states[i].next[c] = ac.states[i].next[c - ('a' - 'A')];
+            }
+        }
+    }
+
+    return ac;
+}
+
+static inline i32 aho__output(const aho_t *ac, i32 state) {
+    const acstate_t *st = &ac->states[state];
+    if (st->out >= 0) return st->out;
+    return st->dict >= 0 ? ac->states[st->dict].out : -1;
+}
+
+bool aho_find(const aho_t *ac, strview_t name, bool suffix, match_t *m) {
+    i32 state = 0;
+
+    for (usize i = 0; i < name.len; ++i) {
+        state = ac->states[state].next[(u8)name.buf[i]];
+
+        if (!suffix) {
+            i32 pattern = aho__output(ac, state);
+            if (pattern >= 0) {
+                *m = (match_t){ i + 1 - ac->lens[pattern], ac->lens[pattern], pattern };
+                return true;
+            }
+        }
+    }
+
+    if (suffix) {
+        // anything that ends on the last state is a suffix of the name
+        i32 pattern = aho__output(ac, state);
+        if (pattern >= 0) {
+            *m = (match_t){ name.len - ac->lens[pattern], ac->lens[pattern], pattern };
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// -- dispatch ------------------------------------- //
+
+bool name_match(worker_t *data, strview_t name, match_t *m) {
+    switch (opt.mode) {
+        case MATCH_MODE_EXACT:
+            if (!matcher_ends_with(&matcher, name)) {
+                return false;
+            }
+            *m = (match_t){ name.len - matcher.needle.len, matcher.needle.len };
+            return true;
+
+        case MATCH_MODE_GLOB:
+            if (!glob_match(globs, name, !opt.case_sensitive)) {
+                return false;
+            }
+            *m = (match_t){ 0, name.len };
+            return true;
+
+        case MATCH_MODE_REGEX:
+            if (regex.prefilter.find && regex.prefilter.find(&regex.prefilter, name) == STR_NONE) {
+                return false;
+            }
+            if (!regex_match(data->dfa, name)) {
+                return false;
+            }
+            // the dfa only tells us whether it matched, highlight the whole name
+            *m = (match_t){ 0, name.len };
+            return true;
+
+        case MATCH_MODE_MULTI:
+            return aho_find(&aho, name, opt.multi_suffix, m);
+
+        default:
+        {
+            usize index = matcher.find(&matcher, name);
+            if (index == STR_NONE) {
+                return false;
+            }
+            *m = (match_t){ index, matcher.needle.len };
+            return true;
+        }
+    }
+}
+
+void bench__run(worker_t *bench, strview_t *names, usize count, strview_t mode, strview_t variant) {
+    f64 tps = (f64)term__get_ticks_per_second();
+    u64 matched = 0;
+    u64 checked = 0;
+    i64 begin = term__get_ticks();
+    i64 end = begin;
+
+    // keep going for at least half a second to get a stable number
+    while ((f64)(end - begin) / tps < 0.5) {
+        for (usize i = 0; i < count; ++i) {
+            match_t m;
+            matched += name_match(bench, names[i], &m);
+        }
+        checked += count;
+        end = term__get_ticks();
+    }
+
+    f64 sec = (f64)(end - begin) / tps;
+    print(
+        "%-10v %-8v %12.0f names/s (%llu matches)\n",
+        mode,
+        variant,
+        (f64)checked / sec,
+        matched / (checked / count)
+    );
+}
+
+void bench_match(arena_t *arena, strview_t corpus_fname) {
+    str_t corpus = os_file_read_all_str(arena, corpus_fname);
+    if (str_is_empty(corpus)) {
+        fatal("couldn't read name corpus from %v", corpus_fname);
+    }
+
+    // one path per line, only the file name gets matched like during the walk
+    usize count = 0;
+    instream_t in = istr_init(strv(corpus));
+    while (!istr_is_finished(&in)) {
+        istr_get_line(&in);
+        count++;
+    }
+
+    strview_t *names = alloc(arena, strview_t, count);
+    count = 0;
+    in = istr_init(strv(corpus));
+    while (!istr_is_finished(&in)) {
+        strview_t line = strv_trim(istr_get_line(&in));
+        usize slash = line.len;
+        while (slash > 0 && line.buf[slash - 1] != '/' && line.buf[slash - 1] != '\\') {
+            slash--;
+        }
+        if (slash < line.len) {
+            names[count++] = strv_remove_prefix(line, slash);
+        }
+    }
+
+    if (!count) {
+        fatal("name corpus %v is empty", corpus_fname);
+    }
+
+    match_isa_e best = match_detect_isa();
+    match_mode_e mode = opt.mode;
+    strview_t mode_name = mode == MATCH_MODE_REGEX ? strv("regex") : strv("substring");
+
+    worker_t bench = {0};
+    if (mode == MATCH_MODE_REGEX) {
+        bench.dfa = dfa_make(arena);
+    }
+
+    print("%zu names, pattern \"%v\"\n", count, opt.tofind_original);
+
+    matcher_t prefilter = regex.prefilter;
+
+    for (match_isa_e isa = MATCH_ISA_SCALAR; isa <= best; ++isa) {
+        matcher = matcher_make(matcher.needle, matcher.fold, isa);
+        if (prefilter.find) {
+            regex.prefilter = matcher_make(prefilter.needle, prefilter.fold, isa);
+        }
+        bench__run(&bench, names, count, mode_name, match_isa_names[isa]);
+    }
+
+    if (mode == MATCH_MODE_REGEX) {
+        regex.prefilter = (matcher_t){0};
+        bench__run(&bench, names, count, mode_name, strv("dfa only"));
+
+        if (prefilter.find) {
+            // same literal the prefilter uses, as a plain substring search
+            opt.mode = MATCH_MODE_SUBSTRING;
+            matcher = matcher_make(prefilter.needle, prefilter.fold, best);
+            bench__run(&bench, names, count, strv("substring"), match_isa_names[best]);
+            print("(substring needle: \"%v\")\n", prefilter.needle);
+        }
+    }
+}
+
+// == COUNTER BENCHMARK ===
+//
+// --bench-counters splits a fixed number of increments over 1 to 64 threads
+// and times the ways of counting them: one interlocked global everybody hits
+// (what checked_count used to be), one plain slot per thread packed next to
+// the others, and one slot per thread on its own cache line like the worker
+// counters. the packed one shows what false sharing alone costs
+
+#define BENCH_COUNTER_OPS (1 << 24)
+
+typedef enum {
+    BENCH_COUNTER_SHARED,
+    BENCH_COUNTER_PACKED,
+    BENCH_COUNTER_PADDED,
+    BENCH_COUNTER__COUNT,
+} benchcounter_e;
+
+const char *bench_counter_names[BENCH_COUNTER__COUNT] = {
+    [BENCH_COUNTER_SHARED] = "shared",
+    [BENCH_COUNTER_PACKED] = "packed",
+    [BENCH_COUNTER_PADDED] = "padded",
+};
+
+typedef struct paddedcounter_t paddedcounter_t;
+struct CACHE_ALIGN paddedcounter_t {
+    volatile u64 value;
+};
+
+struct {
+    benchcounter_e kind;
+    long ops;
+    volatile long ready;
+    volatile long go;
+    CACHE_ALIGN volatile long shared;
+    CACHE_ALIGN volatile u64 packed[64];
+    paddedcounter_t padded[64];
+} bench_counters_state = {0};
+
+int bench__counter_thread(u64 id, void *udata) {
+    COLLA_UNUSED(id);
+    usize index = (usize)udata;
+    long ops = bench_counters_state.ops;
+
+    ATOMIC_INC(bench_counters_state.ready);
+    while (!bench_counters_state.go) {
+        YieldProcessor();
+    }
+
+    switch (bench_counters_state.kind) {
+        case BENCH_COUNTER_SHARED:
+            for (long i = 0; i < ops; ++i) {
+                ATOMIC_INC(bench_counters_state.shared);
+            }
+            break;
+        case BENCH_COUNTER_PACKED: {
+            volatile u64 *slot = &bench_counters_state.packed[index];
+            for (long i = 0; i < ops; ++i) {
+                (*slot)++;
+            }
+            break;
+        }
+        default: {
+            volatile u64 *slot = &bench_counters_state.padded[index].value;
+            for (long i = 0; i < ops; ++i) {
+                (*slot)++;
+            }
+            break;
+        }
+    }
+
+    return 0;
+}
+
+void bench_counters(void) {
+    f64 tps = (f64)term__get_ticks_per_second();
+    oshandle_t bench_threads[64] = {0};
+
+    print("%d increments per run\n", BENCH_COUNTER_OPS);
+    print("threads %12s %12s %12s   (M increments/s)\n", bench_counter_names[0], bench_counter_names[1], bench_counter_names[2]);
+
+    for (int count = 1; count <= 64; count *= 2) {
+        print("%7d", count);
+
+        for (benchcounter_e kind = 0; kind < BENCH_COUNTER__COUNT; ++kind) {
+            bench_counters_state.kind = kind;
+            bench_counters_state.ops = BENCH_COUNTER_OPS / count;
+            bench_counters_state.ready = 0;
+            bench_counters_state.go = false;
+
+            for (int i = 0; i < count; ++i) {
+                bench_threads[i] = os_thread_launch(bench__counter_thread, (void *)(usize)i);
+            }
+
+            // wait for every thread to be up so only the increments get timed
+            while (ATOMIC_GET(bench_counters_state.ready) < count) {
+                YieldProcessor();
+            }
+
+            i64 begin = term__get_ticks();
+            ATOMIC_SET(bench_counters_state.go, 1);
+            for (int i = 0; i < count; ++i) {
+                os_thread_join(bench_threads[i], NULL);
+            }
+            i64 end = term__get_ticks();
+
+            f64 sec = (f64)(end - begin) / tps;
+            f64 total = (f64)bench_counters_state.ops * count;
+            print(" %12.1f", sec > 0.0 ? total / sec / 1e6 : 0.0);
+        }
+
+        print("\n");
+    }
+}
+
+// == TREE BENCHMARK ======
+//
+// --bench-tree <dir> fills dir with the tree the walkers get compared on: three
+// levels of 10 directories and 1000 empty files in each of the 1000 leaves,
+// 1001110 entries in all. nothing in it matches "bench-none", so
+//   fd -I --stats --walk batch -d <dir> bench-none
+//   fd -I --stats --walk generic -d <dir> bench-none
+// only time the listing, --stats prints entries/s for each. add --drop-caches
+// for a cold run. files that are already there are left alone, so it can be
+// run again on a half made tree
+
+#define BENCH_TREE_FANOUT 10
+#define BENCH_TREE_DEPTH  3
+#define BENCH_TREE_FILES  1000
+
+bool bench__tree_file(arena_t scratch, strview_t dir, int index) {
+    str_t path = str_fmt(&scratch, "%v/file_%04d.txt", dir, index);
+    HANDLE fp = CreateFileW(path_to_wide(&scratch, strv(path)), GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fp == INVALID_HANDLE_VALUE) {
+        if (GetLastError() != ERROR_FILE_EXISTS) {
+            fatal("couldn't create %v", path);
+        }
+        return false;
+    }
+    CloseHandle(fp);
+    return true;
+}
+
+void bench__tree_dir(arena_t scratch, strview_t path, int depth, u64 *created) {
+    if (!CreateDirectoryW(path_to_wide(&scratch, path), NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+        fatal("couldn't create directory %v", path);
+    }
+
+    if (depth == BENCH_TREE_DEPTH) {
+        for (int i = 0; i < BENCH_TREE_FILES; ++i) {
+            *created += bench__tree_file(scratch, path, i);
+        }
+        return;
+    }
+
+    for (int i = 0; i < BENCH_TREE_FANOUT; ++i) {
+        str_t child = str_fmt(&scratch, "%v/dir_%d", path, i);
+        bench__tree_dir(scratch, strv(child), depth + 1, created);
+    }
+}
+
+void bench_tree(arena_t *arena, strview_t dir) {
+    f64 tps = (f64)term__get_ticks_per_second();
+    strview_t root = dir;
+    while (strv_ends_with(root, '/') || strv_ends_with(root, '\\')) {
+        root = strv_sub(root, 0, root.len - 1);
+    }
+
+    u64 created = 0;
+    i64 begin = term__get_ticks();
+    bench__tree_dir(*arena, root, 0, &created);
+    i64 end = term__get_ticks();
+
+    print("%llu files created in %.1f s\n", created, (f64)(end - begin) / tps);
+    print("compare with:\n");
+    print("  fd -I --stats --walk batch -d %v bench-none\n", root);
+    print("  fd -I --stats --walk generic -d %v bench-none\n", root);
+}
+
+// == METADATA FILTERS ====
+//
+// --type, --size, --newer and --older are only checked once the name already
+// matched, so a search that doesn't use them never asks for anything. the batch
+// walker gets size, times and attributes for free in every FILE_FULL_DIR_INFO
+// record and hands them over, the generic walker and the index only know the
+// name so they fall back to a GetFileAttributesEx, and only when the filter
+// actually needs more than the name. --type f and d need it too, a link to a
+// file or a directory is neither. the attributes don't say what kind of
+// reparse point it is, only a FindFirstFile does, so that's left for the
+// few entries that are one
+
+typedef struct entrymeta_t entrymeta_t;
+struct entrymeta_t {
+    u64 size;
+    u64 mtime;
+    u32 attributes;
+    u32 reparse_tag;
+    // only filled in with -L
+    u64 file_id;
+};
+
+// other reparse points (onedrive placeholders, dedup, ...) are just directories
+static inline bool entry_is_link(const entrymeta_t *meta) {
+    return meta && 
+           (meta->attributes & FILE_ATTRIBUTE_REPARSE_POINT) &&
+           (meta->reparse_tag == IO_REPARSE_TAG_SYMLINK || meta->reparse_tag == IO_REPARSE_TAG_MOUNT_POINT);
+}
+
+bool filter__needs_meta(void) {
+    return opt.min_size > 0 || 
+           opt.max_size != UINT64_MAX || 
+           opt.newer || 
+           opt.older || 
+           (opt.types & (FILTER_TYPE_FILE | FILTER_TYPE_DIR | FILTER_TYPE_SYMLINK));
+}
+
+bool filter__is_exec(strview_t name) {
+    static const strview_t exts[] = { cstrv(".exe"), cstrv(".com"), cstrv(".bat"), cstrv(".cmd"), cstrv(".ps1") };
+
+    usize dot = strv_rfind(name, '.', 0);
+    if (dot == STR_NONE) {
+        return false;
+    }
+
+    strview_t ext = strv_sub(name, dot, SIZE_MAX);
+    for (int i = 0; i < arrlen(exts); ++i) {
+        if (ext.len != exts[i].len) continue;
+        bool same = true;
+        for (usize k = 0; k < ext.len; ++k) {
+            same &= char_lower(ext.buf[k]) == exts[i].buf[k];
+        }
+        if (same) return true;
+    }
+
+    return false;
+}
+
+bool filter__stat(arena_t scratch, strview_t path, entrymeta_t *meta) {
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if (!GetFileAttributesExW(path_to_wide(&scratch, path), GetFileExInfoStandard, &attr)) {
+        return false;
+    }
+    meta->size = ((u64)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+    meta->mtime = ((u64)attr.ftLastWriteTime.dwHighDateTime << 32) | attr.ftLastWriteTime.dwLowDateTime;
+    meta->attributes = attr.dwFileAttributes;
+
+    if (meta->attributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+        WIN32_FIND_DATAW find;
+        HANDLE handle = FindFirstFileW(path_to_wide(&scratch, path), &find);
+        if (handle != INVALID_HANDLE_VALUE) {
+            meta->reparse_tag = find.dwReserved0;
+            FindClose(handle);
+        }
+    }
+
+    return true;
+}
+
+// path is only used to stat the entry when meta is NULL, it's built lazily from
+// job and name when job isn't NULL
+bool filter_match(worker_t *data, jobdata_t *job, strview_t path, strview_t name, bool is_dir, const entrymeta_t *meta) {
+    if (!opt.filters) {
+        return true;
+    }
+
+    entrymeta_t stat_meta = {0};
+
+    if (filter__needs_meta()) {
+        if (meta) {
+            data->stats_avoided++;
+        }
+        else {
+            arena_t scratch = data->scratch;
+            if (job) {
+                path = strv(str_fmt(&scratch, "%v%v", jobdata_path(&scratch, job), name));
+            }
+            data->stats_issued++;
+            if (!filter__stat(scratch, path, &stat_meta)) {
+                return false;
+            }
+            meta = &stat_meta;
+        }
+    }
+    else {
+        data->stats_avoided++;
+    }
+
+    if (opt.types) {
+        bool is_link = entry_is_link(meta);
+        bool ok = ((opt.types & FILTER_TYPE_FILE)    && !is_dir && !is_link) ||
+                  ((opt.types & FILTER_TYPE_DIR)     && is_dir && !is_link)  ||
+                  ((opt.types & FILTER_TYPE_SYMLINK) && is_link)             ||
+                  ((opt.types & FILTER_TYPE_EXEC)    && !is_dir && filter__is_exec(name));
+        if (!ok) {
+            return false;
+        }
+    }
+
+    // sizes only make sense for files
+    if (opt.min_size > 0 || opt.max_size != UINT64_MAX) {
+        if (is_dir || meta->size < opt.min_size || meta->size > opt.max_size) {
+            return false;
+        }
+    }
+
+    if (opt.newer && meta->mtime < opt.newer) {
+        return false;
+    }
+
+    if (opt.older && meta->mtime > opt.older) {
+        return false;
+    }
+
+    return true;
+}
+
+// == FOLLOWING LINKS =====
+//
+// with -L every directory goes through the visited set before it is listed,
+// keyed by volume serial and file id, the windows (dev, inode). plain
+// directories use the id that came with the parent's listing and are checked
+// before being pushed. roots and links are checked once opened, the id in the
+// listing is the link's own, so we ask the handle where it actually ended up.
+// either way the second time a directory shows up it's skipped, which is what
+// stops link cycles. matched files go in the same set, so a file reachable
+// through several links or hardlinks is reported once
+//
+// the set is split in VISITED_SHARDS open addressing tables, each behind its
+// own lock and on its own cache lines, picked by the top bits of the hash
+
+#define VISITED_SHARD_BITS  6
+#define VISITED_SHARDS      (1 << VISITED_SHARD_BITS)
+#define VISITED_INITIAL_CAP 1024
+
+typedef struct visitslot_t visitslot_t;
+struct visitslot_t {
+    u64 id;
+    u32 volume;
+    u32 used;
+};
+
+typedef struct visitshard_t visitshard_t;
+struct CACHE_ALIGN visitshard_t {
+    oshandle_t mtx;
+    arena_t arena;
+    visitslot_t *slots;
+    u32 mask;
+    u32 count;
+};
+
+visitshard_t visited[VISITED_SHARDS] = {0};
+
+// volume of the root, set before any other directory is opened
+u32 walk_volume = 0;
+
+void visited_init(void) {
+    for (int i = 0; i < VISITED_SHARDS; ++i) {
+        visitshard_t *shard = &visited[i];
+        shard->mtx = os_mutex_create();
+        shard->arena = arena_make(ARENA_VIRTUAL, MB(512));
+        shard->slots = alloc(&shard->arena, visitslot_t, VISITED_INITIAL_CAP);
+        shard->mask = VISITED_INITIAL_CAP - 1;
+    }
+}
+
+static inline u64 visited__hash(u32 volume, u64 id) {
+    // splitmix64 finalizer, file ids are mostly sequential
+    u64 h = id ^ ((u64)volume << 32) ^ volume;
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return h;
+}
+
+void visited__grow(visitshard_t *shard) {
+    u32 cap = (shard->mask + 1) * 2;
+    visitslot_t *slots = alloc(&shard->arena, visitslot_t, cap);
+
+    for (u32 i = 0; i <= shard->mask; ++i) {
+        visitslot_t *old = &shard->slots[i];
+        if (!old->used) {
+            continue;
+        }
+        u32 k = (u32)visited__hash(old->volume, old->id) & (cap - 1);
+        while (slots[k].used) {
+            k = (k + 1) & (cap - 1);
+        }
+        slots[k] = *old;
+    }
+
+    // the old table stays in the arena, it's at most as big as everything after it
+    shard->slots = slots;
+    shard->mask = cap - 1;
+}
+
+// true the first time (volume, id) is seen
+bool visited_insert(u32 volume, u64 id) {
+    u64 h = visited__hash(volume, id);
+    visitshard_t *shard = &visited[h >> (64 - VISITED_SHARD_BITS)];
+    bool inserted = true;
+
+    os_mutex_lock(shard->mtx);
+
+    if ((shard->count + 1) * 4 > (shard->mask + 1) * 3) {
+        visited__grow(shard);
+    }
+
+    u32 k = (u32)h & shard->mask;
+    while (shard->slots[k].used) {
+        if (shard->slots[k].id == id && shard->slots[k].volume == volume) {
+            inserted = false;
+            break;
+        }
+        k = (k + 1) & shard->mask;
+    }
+
+    if (inserted) {
+        shard->slots[k] = (visitslot_t){ .id = id, .volume = volume, .used = 1 };
+        shard->count++;
+    }
+
+    os_mutex_unlock(shard->mtx);
+    return inserted;
+}
+
+bool follow__visit(worker_t *data, u32 volume, u64 id) {
+    if (!opt.stats) {
+        return visited_insert(volume, id);
+    }
+
+    i64 begin = term__get_ticks();
+    bool inserted = visited_insert(volume, id);
+    data->visited_ticks += term__get_ticks() - begin;
+    data->visited_count++;
+    return inserted;
+}
+
+// called once the directory is open, false if it was already listed or
+// it's on another volume with --one-file-system
+bool follow_enter(worker_t *data, jobdata_t *job) {
+    if (!opt.follow || (job->parent && !job->is_link)) {
+        return true;
+    }
+
+    BY_HANDLE_FILE_INFORMATION info = {0};
+    if (!GetFileInformationByHandle(job->handle, &info)) {
+        return false;
+    }
+
+    job->volume = info.dwVolumeSerialNumber;
+    if (!job->parent) {
+        walk_volume = job->volume;
+    }
+    // only a link can take us to another volume, and this is the first time we know where it goes
+    else if (opt.one_file_system && job->volume != walk_volume) {
+        data->pruned_volume++;
+        return false;
+    }
+
+    u64 id = ((u64)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+    if (!follow__visit(data, job->volume, id)) {
+        data->link_cycles++;
+        return false;
+    }
+
+    return true;
+}
+
+// false if the directory was already listed, through a link or as a link's target
+bool follow_dir(worker_t *data, jobdata_t *job, const entrymeta_t *meta) {
+    if (!opt.follow || !meta || entry_is_link(meta)) {
+        return true;
+    }
+
+    if (!follow__visit(data, job->volume, meta->file_id)) {
+        data->link_cycles++;
+        return false;
+    }
+
+    return true;
+}
+
+// false if this file was already reported under another name
+bool follow_result(worker_t *data, jobdata_t *job, bool is_dir, const entrymeta_t *meta) {
+    if (!opt.follow || is_dir || !meta) {
+        return true;
+    }
+
+    if (!follow__visit(data, job->volume, meta->file_id)) {
+        data->link_dupes++;
+        return false;
+    }
+
+    return true;
+}
+
+// == FUZZY ===============
+//
+// every path is scored the way fzf's v1 algorithm does it: find the needle as a
+// subsequence going forward, walk back from where it ended to get the tightest
+// window, then score that window with bonuses for word boundaries and runs of
+// consecutive characters. each worker keeps the best --top hits in a min heap
+// (the worst one at the root, ready to be kicked out), the heaps get merged and
+// sorted once the walk is over, so memory doesn't depend on the size of the tree
+
+#define FUZZY_NO_MATCH           INT32_MIN
+#define FUZZY_SCORE_MATCH        16
+#define FUZZY_GAP_START          3
+#define FUZZY_GAP_EXTEND         1
+#define FUZZY_BONUS_PATH         10
+#define FUZZY_BONUS_BOUNDARY     8
+#define FUZZY_BONUS_CAMEL        7
+#define FUZZY_BONUS_CONSECUTIVE  4
+#define FUZZY_BONUS_FIRST_MULT   2
+#define FUZZY_BONUS_BASENAME     16
+
+typedef struct fuzzyhit_t fuzzyhit_t;
+struct fuzzyhit_t {
+    i32 score;
+    bool is_dir;
+    str_t path;
+    usize cap;
+};
+
+typedef struct fuzzyheap_t fuzzyheap_t;
+struct fuzzyheap_t {
+    fuzzyhit_t *items;
+    int count;
+};
+
+fuzzyhit_t *fuzzy_results = NULL;
+int fuzzy_results_count = 0;
+
+static inline char fuzzy__fold(char c, bool fold) {
+    return fold && c >= 'a' && c <= 'z' ? c - ('a' - 'A') : c;
+}
+
+i32 fuzzy__bonus(strview_t hay, usize i) {
+    if (i == 0) {
+        return FUZZY_BONUS_BOUNDARY;
+    }
+
+    char prev = hay.buf[i - 1];
+    char cur = hay.buf[i];
+
+    if (prev == '/' || prev == '\\') {
+        return FUZZY_BONUS_PATH;
+    }
+    if (prev == '_' || prev == '-' || prev == '.' || prev == ' ') {
+        return FUZZY_BONUS_BOUNDARY;
+    }
+    if (prev >= 'a' && prev <= 'z' && cur >= 'A' && cur <= 'Z') {
+        return FUZZY_BONUS_CAMEL;
+    }
+    if (!char_is_alpha(prev) && !char_is_num(prev) && (char_is_alpha(cur) || char_is_num(cur))) {
+        return FUZZY_BONUS_BOUNDARY;
+    }
+    return 0;
+}
+
+// positions is optional, gets the index of every needle character in hay
+i32 fuzzy_score(strview_t needle, strview_t hay, bool fold, usize *positions) {
+    if (needle.len == 0) {
+        return 0;
+    }
+
+    usize n = 0;
+    usize end = STR_NONE;
+    for (usize i = 0; i < hay.len; ++i) {
+        if (fuzzy__fold(hay.buf[i], fold) == needle.buf[n] && ++n == needle.len) {
+            end = i;
+            break;
+        }
+    }
+
+    if (end == STR_NONE) {
+        return FUZZY_NO_MATCH;
+    }
+
+    usize start = end;
+    n = needle.len;
+    for (usize i = end + 1; i-- > 0;) {
+        if (fuzzy__fold(hay.buf[i], fold) == needle.buf[n - 1] && --n == 0) {
+            start = i;
+            break;
+        }
+    }
+
+    i32 score = 0;
+    i32 run_bonus = 0;
+    bool in_gap = false;
+    usize k = 0;
+
+    for (usize i = start; i <= end; ++i) {
+        char c = fuzzy__fold(hay.buf[i], fold);
+
+        if (k < needle.len && c == needle.buf[k]) {
+            i32 bonus = fuzzy__bonus(hay, i);
+
+            // a run keeps the bonus of the boundary it started on
+            if (!in_gap && k > 0) {
+                run_bonus = MAX(run_bonus, FUZZY_BONUS_CONSECUTIVE);
+                bonus = MAX(bonus, run_bonus);
+            }
+            else {
+                run_bonus = bonus;
+            }
+
+            score += FUZZY_SCORE_MATCH + (k == 0 ? bonus * FUZZY_BONUS_FIRST_MULT : bonus);
+            if (positions) positions[k] = i;
+            k++;
+            in_gap = false;
+        }
+        else {
+            score -= in_gap ? FUZZY_GAP_EXTEND : FUZZY_GAP_START;
+            in_gap = true;
+            run_bonus = 0;
+        }
+    }
+
+    // matches that land entirely in the file name are usually what you want
+    usize slash = hay.len;
+    while (slash > 0 && hay.buf[slash - 1] != '/' && hay.buf[slash - 1] != '\\') {
+        slash--;
+    }
+    if (start >= slash) {
+        score += FUZZY_BONUS_BASENAME;
+    }
+
+    return score;
+}
+
+void fuzzyheap__swap(fuzzyhit_t *a, fuzzyhit_t *b) {
+    fuzzyhit_t tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+void fuzzyheap__sift_down(fuzzyheap_t *heap, int i) {
+    while (true) {
+        int l = i * 2 + 1;
+        int r = l + 1;
+        int smallest = i;
+        if (l < heap->count && heap->items[l].score < heap->items[smallest].score) smallest = l;
+        if (r < heap->count && heap->items[r].score < heap->items[smallest].score) smallest = r;
+        if (smallest == i) break;
+        fuzzyheap__swap(&heap->items[i], &heap->items[smallest]);
+        i = smallest;
+    }
+}
+
+void fuzzyheap__sift_up(fuzzyheap_t *heap, int i) {
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (heap->items[parent].score <= heap->items[i].score) break;
+        fuzzyheap__swap(&heap->items[i], &heap->items[parent]);
+        i = parent;
+    }
+}
+
+void fuzzyheap__set_path(arena_t *arena, fuzzyhit_t *hit, strview_t path) {
+    // the slot keeps its buffer when it gets evicted, only grow it when it's too small
+    if (hit->cap < path.len) {
+        hit->cap = MAX(path.len, 128);
+        hit->path.buf = alloc(arena, char, hit->cap);
+    }
+    memcpy(hit->path.buf, path.buf, path.len);
+    hit->path.len = path.len;
+}
+
+void fuzzyheap_push(arena_t *arena, fuzzyheap_t *heap, i32 score, strview_t path, bool is_dir) {
+    if (heap->count < opt.top) {
+        fuzzyhit_t *hit = &heap->items[heap->count];
+        hit->score = score;
+        hit->is_dir = is_dir;
+        fuzzyheap__set_path(arena, hit, path);
+        fuzzyheap__sift_up(heap, heap->count++);
+        return;
+    }
+
+    if (score <= heap->items[0].score) {
+        return;
+    }
+
+    fuzzyhit_t *root = &heap->items[0];
+    root->score = score;
+    root->is_dir = is_dir;
+    fuzzyheap__set_path(arena, root, path);
+    fuzzyheap__sift_down(heap, 0);
+}
+
+int fuzzy__cmp_hits(const void *a, const void *b) {
+    const fuzzyhit_t *ha = a;
+    const fuzzyhit_t *hb = b;
+    if (ha->score != hb->score) {
+        return ha->score < hb->score ? 1 : -1;
+    }
+    // shorter paths first when the score is the same
+    return ha->path.len < hb->path.len ? -1 : ha->path.len > hb->path.len;
+}
+
+void fuzzy_merge(arena_t *arena) {
+    int total = 0;
+    for (int i = 0; i < opt.j; ++i) {
+        total += workers[i].fuzzy ? workers[i].fuzzy->count : 0;
+    }
+
+    fuzzy_results = alloc(arena, fuzzyhit_t, total + 1);
+    for (int i = 0; i < opt.j; ++i) {
+        if (!workers[i].fuzzy) continue;
+        memcpy(fuzzy_results + fuzzy_results_count, workers[i].fuzzy->items, sizeof(fuzzyhit_t) * workers[i].fuzzy->count);
+        fuzzy_results_count += workers[i].fuzzy->count;
+    }
+
+    qsort(fuzzy_results, fuzzy_results_count, sizeof(fuzzyhit_t), fuzzy__cmp_hits);
+    fuzzy_results_count = MIN(fuzzy_results_count, opt.top);
+}
+
+fuzzyheap_t *fuzzyheap_make(arena_t *arena) {
+    fuzzyheap_t *heap = alloc(arena, fuzzyheap_t);
+    heap->items = alloc(arena, fuzzyhit_t, opt.top);
+    return heap;
+}
+
+void try_add_fuzzy(worker_t *data, jobdata_t *job, strview_t name, bool is_dir, const entrymeta_t *meta) {
+    strview_t path = worker_path(data, job, name);
+
+    i32 score = fuzzy_score(strv(opt.tofind), path, !opt.case_sensitive, NULL);
+    if (score == FUZZY_NO_MATCH) {
+        return;
+    }
+
+    if (!filter_match(data, job, STRV_EMPTY, name, is_dir, meta) || !follow_result(data, job, is_dir, meta)) {
+        return;
+    }
+
+    data->found++;
+    fuzzyheap_push(&data->arena, data->fuzzy, score, path, is_dir);
+}
+
+// == CONTENT SEARCH ======
+//
+// -c <text> also looks inside every file whose name matches. files up to
+// CONTENT_READ_MAX are read into a buffer each worker keeps around, bigger
+// ones are mapped instead of copied. if the first few kb have a NUL byte in
+// them the file is binary and gets skipped, like grep does. the text itself is
+// found with the same simd matcher used for names, and the newlines between
+// two hits are counted 16 bytes at a time to know the line number
+
+#define CONTENT_READ_MAX    KB(256)
+#define CONTENT_BINARY_PEEK KB(8)
+
+matcher_t content_matcher = {0};
+
+static inline u32 content__popcount(u32 mask) {
+#if COLLA_MSVC
+    return (u32)__popcnt(mask);
+#else
+    return (u32)__builtin_popcount(mask);
+#endif
+}
+
+usize content__count_lines(const char *buf, usize len) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    usize count = 0;
+    usize i = 0;
+
+    for (; (i + 16) <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        count += content__popcount((u32)_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline)));
+    }
+
+    for (; i < len; ++i) {
+        count += buf[i] == '\n';
+    }
+
+    return count;
+}
+
+void content__scan(worker_t *data, strview_t path, strview_t text) {
+    if (memchr(text.buf, '\0', MIN(text.len, CONTENT_BINARY_PEEK))) {
+        data->content_binary++;
+        return;
+    }
+
+    usize line = 1;
+    usize counted = 0;
+    usize from = 0;
+
+    while (from < text.len && !walk_cancelled()) {
+        usize index = content_matcher.find(&content_matcher, strv_sub(text, from, SIZE_MAX));
+        if (index == STR_NONE) {
+            break;
+        }
+
+        usize pos = from + index;
+        line += content__count_lines(text.buf + counted, pos - counted);
+        counted = pos;
+
+        usize start = pos;
+        while (start > 0 && text.buf[start - 1] != '\n') {
+            start--;
+        }
+        const char *newline = memchr(text.buf + pos, '\n', text.len - pos);
+        usize end = newline ? (usize)(newline - text.buf) : text.len;
+
+        strview_t line_text = strv(text.buf + start, end - start);
+        if (line_text.len && line_text.buf[line_text.len - 1] == '\r') {
+            line_text.len--;
+        }
+
+        if (!result_claim(data)) {
+            break;
+        }
+
+        output_hit(data, path, (u64)line, (u64)(pos - start + 1), line_text);
+
+        // one report per line, the next hit can only be on a later one
+        from = end + 1;
+    }
+}
+
+void content_search(worker_t *data, jobdata_t *job, strview_t name) {
+    HANDLE fp = NULL;
+    if (opt.walker != WALKER_GENERIC && job->handle) {
+        fp = file_open_at(data->scratch, job->handle, name);
+    }
+    else {
+        arena_t scratch = data->scratch;
+        str_t full = str_fmt(&scratch, "%v%v", jobdata_path(&scratch, job), name);
+        fp = file_open_at(scratch, NULL, strv(full));
+    }
+
+    if (!fp) {
+        return;
+    }
+
+    strview_t path = worker_path(data, job, name);
+
+    LARGE_INTEGER size = {0};
+    GetFileSizeEx(fp, &size);
+
+    if (size.QuadPart > 0 && size.QuadPart <= CONTENT_READ_MAX) {
+        DWORD read = 0;
+        if (ReadFile(fp, data->content_buf, (DWORD)size.QuadPart, &read, NULL)) {
+            content__scan(data, path, strv(data->content_buf, read));
+        }
+        data->content_read++;
+    }
+    else if (size.QuadPart > 0) {
+        HANDLE mapping = CreateFileMappingW(fp, NULL, PAGE_READONLY, 0, 0, NULL);
+        const char *view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+        if (view) {
+            content__scan(data, path, strv(view, (usize)size.QuadPart));
+            UnmapViewOfFile(view);
+            data->content_mapped++;
+        }
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+    }
+
+    CloseHandle(fp);
+}
+
+void try_add_path(worker_t *data, jobdata_t *job, strview_t name, bool is_dir, const entrymeta_t *meta) {
+    data->checked++;
+
+    if (opt.mode == MATCH_MODE_FUZZY) {
+        try_add_fuzzy(data, job, name, is_dir, meta);
+        return;
+    }
+
+    result_t res = {0};
+
+    match_t m = {0};
+    if (!name_match(data, name, &m)) {
+        return;
+    }
+
+    if (!filter_match(data, job, STRV_EMPTY, name, is_dir, meta) || !follow_result(data, job, is_dir, meta)) {
+        return;
+    }
+
+    if (!str_is_empty(opt.content)) {
+        if (!is_dir) {
+            content_search(data, job, name);
+        }
+        return;
+    }
+
+    if (!result_claim(data)) {
+        return;
+    }
+
+    if (opt.stream) {
+        if (opt.mode == MATCH_MODE_MULTI) {
+            ATOMIC_INC(pattern_found[m.pattern]);
+        }
+        strview_t path = worker_path(data, job, name);
+        if (opt.sorted) {
+            sorted_push(data, path, m.pattern);
+        }
+        else if (opt.exec_count) {
+            exec_push(path);
+        }
+        else {
+            output_line(data, path, m.pattern);
+        }
+        return;
+    }
+
+    // the ui shows everything once the walk is over, the results live in the worker's arena
+    res.before = jobdata_path(&data->arena, job);
+    res.name = str(&data->arena, strv_sub(name, 0, m.index));
+    res.match = str(&data->arena, strv_sub(name, m.index, m.index + m.len));
+    res.after = str(&data->arena, strv_sub(name, m.index + m.len, SIZE_MAX));
+    res.pattern = m.pattern;
+    
+    if (res.before.buf[0] == '.' &&
+            (res.before.buf[1] == '/' ||
+             res.before.buf[1] == '\\')
+       ) {
+        res.before.buf += 2;
+        res.before.len -= 2;
+    }
+
+    if (is_dir) {
+        res.icon = icons[ICON_STYLE_NERD][ICON_FOLDER];
+    }
+    else {
+        strview_t ext;
+        os_file_split_path(name, NULL, NULL, &ext);
+        res.icon = ext_to_ico(ext);
+    }
+    
+    if (opt.mode == MATCH_MODE_MULTI) {
+        ATOMIC_INC(pattern_found[m.pattern]);
+    }
+
+    darr_push(&data->arena, data->results, res);
+}
+
+// == IGNORE FILES ========
+//
+// .gitignore and .ignore are read when a directory gets listed and compiled
+// into one ignore_t layer for it. the layer points to the one of the parent
+// directory and child jobs just keep a pointer to the innermost layer, so a
+// directory without ignore files costs nothing and nothing is ever copied.
+// rules are checked from the innermost layer out and from the last line up,
+// the first one that matches decides, like git does. ignored directories are
+// never pushed, so their whole subtree is skipped
+//
+// most lines are either plain names (node_modules) or extensions (*.o), those
+// are compiled to a compare or an ends_with, everything else goes through
+// ignore__wildmatch
+
+#define IGNORE_MAX_FILE_SIZE MB(1)
+
+typedef enum {
+    IGNORE_LITERAL,
+    IGNORE_SUFFIX,
+    IGNORE_GLOB,
+} ignorekind_e;
+
+typedef struct ignorerule_t ignorerule_t;
+struct ignorerule_t {
+    strview_t pattern;
+    ignorekind_e kind;
+    bool negate;
+    bool dir_only;
+    // has a slash in it, matched against the path relative to the ignore file
+    bool anchored;
+};
+
+typedef struct ignore_t ignore_t;
+struct ignore_t {
+    ignore_t *parent;
+    ignorerule_t *rules;
+    int count;
+    // length of the directory's path (with the trailing slash) inside the
+    // paths built by worker_path
+    usize base_len;
+};
+
+bool ignore__wild(const char *p, const char *pe, const char *t, const char *te) {
+    while (p < pe) {
+        char c = *p;
+
+        if (c == '*') {
+            if ((p + 1) < pe && p[1] == '*') {
+                p += 2;
+                // "**/" matches zero or more whole directories
+                if (p < pe && *p == '/') {
+                    p++;
+                    const char *s = t;
+                    while (true) {
+                        if (ignore__wild(p, pe, s, te)) return true;
+                        s = memchr(s, '/', te - s);
+                        if (!s) return false;
+                        s++;
+                    }
+                }
+                for (const char *s = t; s <= te; ++s) {
+                    if (ignore__wild(p, pe, s, te)) return true;
+                }
+                return false;
+            }
+
+            p++;
+            for (const char *s = t; ; ++s) {
+                if (ignore__wild(p, pe, s, te)) return true;
+                if (s == te || *s == '/') return false;
+            }
+        }
+
+        if (t == te) {
+            return false;
+        }
+
+        if (c == '?') {
+            if (*t == '/') return false;
+        }
+        else if (c == '[') {
+            const char *q = p + 1;
+            bool negate = q < pe && (*q == '!' || *q == '^');
+            if (negate) q++;
+
+            const char *close = q < pe ? memchr(q + 1, ']', pe - q - 1) : NULL;
+            if (!close) {
+                // no closing bracket, it's just a character
+                if (*t != '[') return false;
+            }
+            else {
+                bool found = false;
+                for (; q < close; ++q) {
+                    if ((q + 2) < close && q[1] == '-') {
+                        found |= *t >= q[0] && *t <= q[2];
+                        q += 2;
+                    }
+                    else {
+                        found |= *t == *q;
+                    }
+                }
+                if (found == negate || *t == '/') return false;
+                p = close;
+            }
+        }
+        else {
+            if (c == '\\' && (p + 1) < pe) {
+                c = *++p;
+            }
+            if (c != *t) return false;
+        }
+
+        p++;
+        t++;
+    }
+
+    return t == te;
+}
+
+bool ignore__wildmatch(strview_t pattern, strview_t text) {
+    return ignore__wild(pattern.buf, pattern.buf + pattern.len, text.buf, text.buf + text.len);
+}
+
+bool ignore__has_wildcards(strview_t v) {
+    return strv_find_either(v, strv("*?[\\"), 0) != STR_NONE;
+}
+
+void ignore__compile(arena_t *arena, ignorerule_t **rules, int *count, int *cap, strview_t text) {
+    instream_t in = istr_init(text);
+
+    while (!istr_is_finished(&in)) {
+        strview_t line = istr_get_line(&in);
+
+        while (line.len && (line.buf[line.len - 1] == '\r' || line.buf[line.len - 1] == ' ')) {
+            // "foo\ " keeps its trailing space
+            if (line.buf[line.len - 1] == ' ' && line.len > 1 && line.buf[line.len - 2] == '\\') break;
+            line.len--;
+        }
+
+        if (!line.len || line.buf[0] == '#') {
+            continue;
+        }
+
+        ignorerule_t rule = {0};
+
+        if (line.buf[0] == '!') {
+            rule.negate = true;
+            line = strv_remove_prefix(line, 1);
+        }
+        else if (line.buf[0] == '\\' && line.len > 1 && (line.buf[1] == '!' || line.buf[1] == '#')) {
+            line = strv_remove_prefix(line, 1);
+        }
+
+        if (line.len && line.buf[line.len - 1] == '/') {
+            rule.dir_only = true;
+            line = strv_remove_suffix(line, 1);
+        }
+
+        if (strv_find(line, '/', 0) != STR_NONE) {
+            rule.anchored = true;
+            if (line.buf[0] == '/') {
+                line = strv_remove_prefix(line, 1);
+            }
+        }
+
+        if (!line.len) {
+            continue;
+        }
+
+        if (!ignore__has_wildcards(line)) {
+            rule.kind = IGNORE_LITERAL;
+        }
+        else if (!rule.anchored && line.buf[0] == '*' && !ignore__has_wildcards(strv_remove_prefix(line, 1))) {
+            rule.kind = IGNORE_SUFFIX;
+            line = strv_remove_prefix(line, 1);
+        }
+        else {
+            rule.kind = IGNORE_GLOB;
+        }
+
+        rule.pattern = line;
+
+        if (*count >= *cap) {
+            int new_cap = MAX(*cap * 2, 16);
+            ignorerule_t *new_rules = alloc(arena, ignorerule_t, new_cap);
+            if (*count) {
+                memcpy(new_rules, *rules, sizeof(ignorerule_t) * *count);
+            }
+            *rules = new_rules;
+            *cap = new_cap;
+        }
+        (*rules)[(*count)++] = rule;
+    }
+}
+
+str_t ignore__read(worker_t *data, jobdata_t *job, strview_t name) {
+    if (opt.walker == WALKER_GENERIC) {
+        arena_t scratch = data->scratch;
+        str_t dir = jobdata_path(&scratch, job);
+        str_t path = str_fmt(&scratch, "%v%v", dir, name);
+
+        if (!os_file_exists(strv(path))) {
+            return STR_EMPTY;
+        }
+        oshandle_t fp = os_file_open(strv(path), FILEMODE_READ);
+        if (!os_handle_valid(fp)) {
+            return STR_EMPTY;
+        }
+        str_t text = os_file_read_all_str_fp(&data->arena, fp);
+        os_file_close(fp);
+        return text;
+    }
+
+    HANDLE fp = file_open_at(data->scratch, job->handle, name);
+    if (!fp) {
+        return STR_EMPTY;
+    }
+
+    str_t text = STR_EMPTY;
+    LARGE_INTEGER size = {0};
+    if (GetFileSizeEx(fp, &size) && size.QuadPart > 0 && size.QuadPart <= IGNORE_MAX_FILE_SIZE) {
+        text.buf = alloc(&data->arena, char, size.QuadPart + 1);
+        DWORD read = 0;
+        if (ReadFile(fp, text.buf, (DWORD)size.QuadPart, &read, NULL)) {
+            text.len = read;
+        }
+    }
+
+    CloseHandle(fp);
+    return text;
+}
+
+// called with the directory open, before any of its entries are visited
+void ignore_load(worker_t *data, jobdata_t *job) {
+    static const strview_t names[] = { cstrv(".gitignore"), cstrv(".ignore") };
+
+    ignorerule_t *rules = NULL;
+    int count = 0;
+    int cap = 0;
+
+    // .ignore is read last so its rules win over .gitignore
+    for (int i = 0; i < arrlen(names); ++i) {
+        str_t text = ignore__read(data, job, names[i]);
+        if (text.len) {
+            data->ignore_files++;
+            ignore__compile(&data->arena, &rules, &count, &cap, strv(text));
+        }
+    }
+
+    if (!count) {
+        return;
+    }
+
+    ignore_t *layer = alloc(&data->arena, ignore_t);
+    layer->parent = job->ignore;
+    layer->rules = rules;
+    layer->count = count;
+    layer->base_len = worker_path(data, job, strv("")).len;
+    job->ignore = layer;
+}
+
+bool ignore_match(worker_t *data, jobdata_t *job, strview_t name, bool is_dir) {
+    strview_t path = {0};
+
+    for (ignore_t *layer = job->ignore; layer; layer = layer->parent) {
+        for (int i = layer->count - 1; i >= 0; --i) {
+            ignorerule_t *rule = &layer->rules[i];
+
+            if (rule->dir_only && !is_dir) {
+                continue;
+            }
+
+            bool hit = false;
+            if (rule->anchored) {
+                if (!path.buf) {
+                    path = worker_path(data, job, name);
+                }
+                hit = ignore__wildmatch(rule->pattern, strv_remove_prefix(path, layer->base_len));
+            }
+            else switch (rule->kind) {
+                case IGNORE_LITERAL: hit = strv_equals(name, rule->pattern); break;
+                case IGNORE_SUFFIX:  hit = strv_ends_with_view(name, rule->pattern); break;
+                case IGNORE_GLOB:    hit = ignore__wildmatch(rule->pattern, name); break;
+            }
+
+            if (hit) {
+                return !rule->negate;
+            }
+        }
+    }
+
+    return false;
+}
+
+// == JOB BATCHES =========
+//
+// child directories found while listing are collected in the worker's batch
+// and published together once the listing (or a chunk of it) is done: one add
+// for the parent's references, one for pending_jobs, one barrier to make them
+// all stealable and a single trip through park_mtx that wakes as many parked
+// workers as there are new jobs, instead of all of that for every directory
+
+void job_batch_publish(worker_t *data, jobdata_t *job) {
+    long count = data->batch_count;
+    if (!count) {
+        return;
+    }
+
+    // we still own a reference to job, nobody else can drop these to zero under us
+    ATOMIC_ADD(job->refs, count);
+    ATOMIC_ADD(job->open_refs, count);
+
+    ATOMIC_ADD(pending_jobs, count);
+    jobdeque_push_many(data, data->batch, count);
+    worker_wake(data, count);
+
+    data->batches_published++;
+    data->batch_count = 0;
+}
+
+// == DIRECTORY WALKING ===
+//
+// the batch walker (default) opens the directory once and pulls entries out
+// of it in 64kb chunks with GetFileInformationByHandleEx, each record already
+// has the attributes so we know whether it is a directory without any extra
+// call. the generic walker goes through os_dir_open/dir_foreach and is kept
+// around to compare against (--walk generic). --walk async is further down
+
+void add_dirs__visit(worker_t *data, jobdata_t *job, strview_t name, bool is_dir, const entrymeta_t *meta) {
+    if (strv_equals(name, CURDIR) || strv_equals(name, PREVDIR)) {
+        return;
+    }
+
+    data->entries++;
+
+    if (is_dir && !opt.all_dirs && name.buf[0] == '.') {
+        return;
+    }
+
+    if (job->ignore && ignore_match(data, job, name, is_dir)) {
+        data->ignored++;
+        return;
+    }
+
+    // the rest of the listing is thrown away, don't start anything new
+    if (walk_cancelled()) {
+        return;
+    }
+
+    // links are only walked into with -L, otherwise they are just matched by name.
+    // a directory whose entries would all be past --max-depth is never pushed
+    bool is_link = entry_is_link(meta);
+    if (is_dir && (!is_link || opt.follow)) {
+        if (opt.max_depth && job->depth + 2 > opt.max_depth) {
+            data->pruned_depth++;
+        }
+        else if (follow_dir(data, job, meta)) {
+            if (data->batch_count == JOB_BATCH_MAX) {
+                job_batch_publish(data, job);
+            }
+            jobdata_t *newjob = jobdata_make(data, job, name);
+            newjob->is_link = is_link;
+            data->batch[data->batch_count++] = newjob;
+        }
+    }
+
+    if (job->depth + 1 < opt.min_depth) {
+        data->hidden_min_depth++;
+        return;
+    }
+
+    try_add_path(data, job, name, is_dir, meta);
+}
+
+void add_dirs_generic(worker_t *data, jobdata_t *job) {
+    if (job->parent) {
+        jobdata_close(job->parent);
+    }
+
+    if (!opt.no_ignore) {
+        ignore_load(data, job);
+    }
+
+    arena_t scratch = data->scratch;
+    str_t path = jobdata_path(&scratch, job);
+    dir_t *dir = os_dir_open(&scratch, strv(path));
+    // dir_t *dir = os_dir_open(&data->arena, path);
+
+    // dir_foreach(&data->arena, entry, dir) {
+    dir_foreach(&scratch, entry, dir) {
+        if (walk_cancelled()) {
+            break;
+        }
+        add_dirs__visit(data, job, strv(entry->name), entry->type == DIRTYPE_DIR, NULL);
+    }
+
+    job_batch_publish(data, job);
+}
+
+// one buffer of FILE_FULL_DIR_INFO records, the batch and async walkers get
+// them in the same format. -L asks for FILE_ID_BOTH_DIR_INFO instead, it
+// starts with the same fields and has the file id before the name
+void add_dirs__chunk(worker_t *data, jobdata_t *job, u8 *buf) {
+    char name_buf[MAX_PATH * 4];
+    u8 *cur = buf;
+
+    while (true) {
+        FILE_FULL_DIR_INFO *info = (FILE_FULL_DIR_INFO *)cur;
+        FILE_ID_BOTH_DIR_INFO *id_info = (FILE_ID_BOTH_DIR_INFO *)cur;
+
+        int name_len = WideCharToMultiByte(
+            CP_UTF8, 0, 
+            opt.follow ? id_info->FileName : info->FileName, (int)(info->FileNameLength / sizeof(WCHAR)), 
+            name_buf, sizeof(name_buf), 
+            NULL, NULL
+        );
+
+        bool is_dir = info->FileAttributes & FILE_ATTRIBUTE_DIRECTORY;
+        entrymeta_t meta = {
+            .size = (u64)info->EndOfFile.QuadPart,
+            .mtime = (u64)info->LastWriteTime.QuadPart,
+            .attributes = info->FileAttributes,
+            // EaSize holds the reparse tag for reparse points
+            .reparse_tag = (info->FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) ? info->EaSize : 0,
+            .file_id = opt.follow ? (u64)id_info->FileId.QuadPart : 0,
+        };
+        add_dirs__visit(data, job, strv(name_buf, name_len), is_dir, &meta);
+
+        if (info->NextEntryOffset == 0) {
+            break;
+        }
+        cur += info->NextEntryOffset;
+    }
+
+    // don't keep the other workers waiting on the rest of a huge directory
+    job_batch_publish(data, job);
+}
+
+void add_dirs_batch(worker_t *data, jobdata_t *job) {
+    job->handle = dir_open_at(data->scratch, job->parent ? job->parent->handle : NULL, strv(job->name));
+
+    // the parent's handle was only kept around for us
+    if (job->parent) {
+        jobdata_close(job->parent);
+    }
+
+    if (!job->handle || !follow_enter(data, job)) {
+        return;
+    }
+
+    if (!opt.no_ignore) {
+        ignore_load(data, job);
+    }
+
+    FILE_INFO_BY_HANDLE_CLASS info_class = opt.follow ? FileIdBothDirectoryInfo : FileFullDirectoryInfo;
+    while (!walk_cancelled() && GetFileInformationByHandleEx(job->handle, info_class, data->walk_buf, WALK_BUFFER_SIZE)) {
+        add_dirs__chunk(data, job, data->walk_buf);
+    }
+}
+
+void add_dirs(worker_t *data, jobdata_t *job) {
+    switch (opt.walker) {
+        case WALKER_GENERIC: add_dirs_generic(data, job); break;
+        default:             add_dirs_batch(data, job);   break;
+    }
+
+    jobdata_close(job);
+}
+
+u32 worker__rand(worker_t *data) {
+    // xorshift32
+    u32 x = data->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    data->rng = x;
+    return x;
+}
+
+jobdata_t *worker__find_job(worker_t *data) {
+    jobdata_t *job = jobdeque_pop(&data->deque);
+    if (job) {
+        return job;
+    }
+
+    // nothing left locally, go around the other workers once starting from a random one
+    u32 start = worker__rand(data);
+    for (int i = 0; i < opt.j; ++i) {
+        worker_t *victim = &workers[(start + i) % opt.j];
+        if (victim == data) {
+            continue;
+        }
+
+        job = jobdeque_steal(&victim->deque);
+        if (job) {
+            data->steals++;
+            return job;
+        }
+
+        data->failed_steals++;
+    }
+
+    return NULL;
+}
+
+void worker__idle(worker_t *data, i64 *idle_since, int *spins) {
+    if (!*idle_since) {
+        *idle_since = term__get_ticks();
+    }
+    // new work usually shows up quickly, spin a bit before going to sleep
+    if (++(*spins) < WORKER_SPIN_ROUNDS) {
+        YieldProcessor();
+    }
+    else {
+        *spins = 0;
+        // don't sit on matches while sleeping
+        if (opt.stream) {
+            output_flush(data);
+        }
+        worker_park(data);
+    }
+}
+
+void worker__busy(worker_t *data, i64 *idle_since, int *spins) {
+    *spins = 0;
+    if (*idle_since) {
+        data->idle_ticks += term__get_ticks() - *idle_since;
+        *idle_since = 0;
+    }
+}
+
+// the listing is over and its handle already closed
+void worker__job_done(worker_t *data, jobdata_t *job) {
+    jobdata_release(data, job);
+    data->jobs_done++;
+
+    if (opt.stream) {
+        output_maybe_flush(data);
+    }
+
+    // children were counted before being pushed, so this can only
+    // reach zero once there is nothing left anywhere
+    if (ATOMIC_DEC(pending_jobs) == 0) {
+        walk_finish();
+    }
+}
+
+void worker__exit(worker_t *data, i64 idle_since) {
+    if (idle_since) {
+        data->idle_ticks += term__get_ticks() - idle_since;
+    }
+
+    if (opt.sorted) {
+        sorted_sort(data);
+    }
+    else if (opt.stream) {
+        output_flush(data);
+    }
+}
+
+int worker(u64 id, void *udata) {
+    COLLA_UNUSED(id);
+
+    worker_t *data = udata;
+    i64 idle_since = 0;
+    int spins = 0;
+    
+    while (!ATOMIC_CHECK(should_quit)) {
+        jobdata_t *job = worker__find_job(data);
+
+        if (!job) {
+            worker__idle(data, &idle_since, &spins);
+            continue;
+        }
+
+        worker__busy(data, &idle_since, &spins);
+        add_dirs(data, job);
+        worker__job_done(data, job);
+    }
+
+    worker__exit(data, idle_since);
+    return 0;
+}
+
+// == ASYNC WALKER ========
+//
+// --walk async keeps many listings in flight on every worker instead of
+// blocking on one at a time, which is what counts when the metadata isn't
+// cached and every read waits on a slow disk or a network share. there is no
+// io_uring here, the windows way is a completion port per worker and
+// NtQueryDirectoryFile on directory handles opened for overlapped i/o: a
+// worker opens up to ASYNC_DEPTH directories, starts a read on each of them
+// and handles whichever completes first, starting the next read on the same
+// handle right away. opening stays synchronous, windows has no async open,
+// and the records already carry size, times and attributes so there is no
+// stat to queue. if ntdll or the port doesn't cooperate we fall back to the
+// batch walker
+
+#define ASYNC_DEPTH       32
+#define ASYNC_BUFFER_SIZE KB(16)
+#define ASYNC_REAP_MAX    16
+
+#define ASYNC_FILE_FULL_DIRECTORY_INFORMATION    2
+#define ASYNC_FILE_ID_BOTH_DIRECTORY_INFORMATION 37
+
+#ifndef NT_ERROR
+#define NT_ERROR(status) ((((ULONG)(status)) >> 30) == 3)
+#endif
+
+typedef NTSTATUS (NTAPI *nt_query_directory_file_f)(
+    HANDLE handle,
+    HANDLE event,
+    PVOID apc_routine,
+    PVOID apc_context,
+    IO_STATUS_BLOCK *status,
+    PVOID buffer,
+    ULONG length,
+    ULONG info_class,
+    BOOLEAN single_entry,
+    UNICODE_STRING *file_name,
+    BOOLEAN restart_scan
+);
+
+nt_query_directory_file_f nt_query_directory_file = NULL;
+
+// one read in flight, it comes back from the port as the "overlapped" pointer
+typedef struct asyncop_t asyncop_t;
+struct asyncop_t {
+    IO_STATUS_BLOCK iosb;
+    jobdata_t *job;
+    asyncop_t *next;
+    u8 *buf;
+};
+
+bool async_init(worker_t *data) {
+    data->port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    if (!data->port) {
+        return false;
+    }
+
+    for (int i = 0; i < ASYNC_DEPTH; ++i) {
+        asyncop_t *op = alloc(&data->arena, asyncop_t);
+        op->buf = (u8 *)alloc(&data->arena, u64, ASYNC_BUFFER_SIZE / sizeof(u64));
+        op->next = data->async_free;
+        data->async_free = op;
+    }
+
+    return true;
+}
+
+// false if the listing is over, anything but an error queues a completion
+// packet, even when the read is done before the call returns
+bool async__read(worker_t *data, asyncop_t *op) {
+    op->iosb = (IO_STATUS_BLOCK){0};
+    NTSTATUS status = nt_query_directory_file(
+        op->job->handle,
+        NULL,
+        NULL,
+        op,
+        &op->iosb,
+        op->buf,
+        ASYNC_BUFFER_SIZE,
+        opt.follow ? ASYNC_FILE_ID_BOTH_DIRECTORY_INFORMATION : ASYNC_FILE_FULL_DIRECTORY_INFORMATION,
+        FALSE,
+        NULL,
+        FALSE
+    );
+
+    if (NT_ERROR(status)) {
+        return false;
+    }
+
+    data->async_reads++;
+    return true;
+}
+
+void async__finish(worker_t *data, jobdata_t *job) {
+    job_batch_publish(data, job);
+    jobdata_close(job);
+    worker__job_done(data, job);
+}
+
+void async__start(worker_t *data, jobdata_t *job) {
+    job->handle = dir_open_overlapped_at(data->scratch, job->parent ? job->parent->handle : NULL, strv(job->name));
+
+    // the parent's handle was only kept around for us
+    if (job->parent) {
+        jobdata_close(job->parent);
+    }
+
+    if (!job->handle || !follow_enter(data, job) || !CreateIoCompletionPort(job->handle, data->port, 0, 0)) {
+        async__finish(data, job);
+        return;
+    }
+
+    if (!opt.no_ignore) {
+        ignore_load(data, job);
+    }
+
+    asyncop_t *op = data->async_free;
+    op->job = job;
+
+    if (!async__read(data, op)) {
+        async__finish(data, job);
+        return;
+    }
+
+    data->async_free = op->next;
+    data->inflight++;
+    data->async_max_inflight = MAX(data->async_max_inflight, (u64)data->inflight);
+}
+
+void async__complete(worker_t *data, asyncop_t *op) {
+    jobdata_t *job = op->job;
+
+    if (NT_SUCCESS(op->iosb.Status) && op->iosb.Information && !walk_cancelled()) {
+        add_dirs__chunk(data, job, op->buf);
+        if (async__read(data, op)) {
+            return;
+        }
+    }
+
+    // STATUS_NO_MORE_FILES or an actual error, either way this listing is over
+    op->next = data->async_free;
+    data->async_free = op;
+    data->inflight--;
+    async__finish(data, job);
+}
+
+int worker_async(u64 id, void *udata) {
+    COLLA_UNUSED(id);
+
+    worker_t *data = udata;
+    i64 idle_since = 0;
+    int spins = 0;
+    OVERLAPPED_ENTRY entries[ASYNC_REAP_MAX];
+
+    while (!ATOMIC_CHECK(should_quit)) {
+        // keep as many reads going as there are buffers for
+        while (data->async_free) {
+            jobdata_t *job = worker__find_job(data);
+            if (!job) {
+                break;
+            }
+            worker__busy(data, &idle_since, &spins);
+            async__start(data, job);
+        }
+
+        if (!data->inflight) {
+            worker__idle(data, &idle_since, &spins);
+            continue;
+        }
+
+        // with free buffers we'd also take new jobs, so other workers have to know
+        // to post to our port when they push some. the barrier in ATOMIC_SET pairs
+        // with the one in worker_wake like in worker_park
+        bool want_jobs = data->async_free != NULL;
+        if (want_jobs) {
+            ATOMIC_SET(data->port_parked, 1);
+            ATOMIC_INC(port_parked_count);
+            if (jobs_available() || walk_cancelled()) {
+                // if somebody beat us to it their packet just gets skipped later
+                worker_port_unpark(data);
+                continue;
+            }
+            data->parks++;
+        }
+
+        // a read completing, a packet from worker_wake or from walk_finish
+        ULONG removed = 0;
+        if (GetQueuedCompletionStatusEx(data->port, entries, ASYNC_REAP_MAX, &removed, INFINITE, FALSE)) {
+            for (ULONG i = 0; i < removed; ++i) {
+                if (entries[i].lpOverlapped) {
+                    async__complete(data, (asyncop_t *)entries[i].lpOverlapped);
+                }
+            }
+        }
+
+        if (want_jobs) {
+            worker_port_unpark(data);
+        }
+    }
+
+    // whatever is still in flight writes into buffers that stay alive until exit
+    worker__exit(data, idle_since);
+    return 0;
+}
+
+// == CACHE DROPPING ======
+//
+// --drop-caches empties the system file cache before the walk, what RAMMap's
+// "empty standby list" does: the cache's working set is trimmed first so its
+// pages end up on the standby list, then the standby list is purged. that's
+// the only way to compare the walkers on a cold tree without rebooting.
+// both steps need privileges only an elevated prompt has
+
+#if COLLA_MSVC
+#pragma comment(lib, "advapi32")
+#endif
+
+#define SYSTEM_MEMORY_LIST_INFORMATION 80
+#define MEMORY_PURGE_STANDBY_LIST      4
+
+typedef NTSTATUS (NTAPI *nt_set_system_information_f)(ULONG info_class, PVOID info, ULONG length);
+
+bool drop__privilege(const char *name) {
+    HANDLE token = NULL;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+        return false;
+    }
+
+    TOKEN_PRIVILEGES privileges = { .PrivilegeCount = 1 };
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+    // AdjustTokenPrivileges succeeds even when it couldn't enable anything
+    bool ok = LookupPrivilegeValueA(NULL, name, &privileges.Privileges[0].Luid) &&
+              AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL) &&
+              GetLastError() == ERROR_SUCCESS;
+
+    CloseHandle(token);
+    return ok;
+}
+
+void drop_caches(void) {
+    if (!drop__privilege("SeIncreaseQuotaPrivilege") || !SetSystemFileCacheSize((SIZE_T)-1, (SIZE_T)-1, 0)) {
+        fatal("couldn't trim the file cache, --drop-caches needs an elevated prompt");
+    }
+
+    nt_set_system_information_f set_info = (nt_set_system_information_f)GetProcAddress(GetModuleHandleA("ntdll.dll"), "NtSetSystemInformation");
+    ULONG command = MEMORY_PURGE_STANDBY_LIST;
+    if (!set_info || !drop__privilege("SeProfileSingleProcessPrivilege") ||
+        !NT_SUCCESS(set_info(SYSTEM_MEMORY_LIST_INFORMATION, &command, sizeof(command)))
+       ) {
+        fatal("couldn't purge the standby list, --drop-caches needs an elevated prompt");
+    }
+}
+
+struct {
+    spinner_t spinner;
+    bool finished;
+    bool should_print;
+} app = {0};
+
+bool app_update(arena_t *arena, float dt, void *udata) {
     if (app.finished) return true;
 
-    spinner_update(&app.spinner, dt);
+    spinner_update(&app.spinner, dt);
+
+    if (!ATOMIC_CHECK(walk_done)) {
+        // sleep on the completion signal for at most a frame instead of
+        // polling, the spinner still gets updated while we wait
+        os_mutex_lock(park_mtx);
+        if (!ATOMIC_CHECK(walk_done)) {
+            os_cond_wait(done_notif, park_mtx, (int)(dt * 1000.f));
+        }
+        os_mutex_unlock(park_mtx);
+
+        if (!ATOMIC_CHECK(walk_done)) return false;
+    }
+
+    if (app.should_print) return true;
+    
+    for (int i = 0; i < opt.j; ++i) {
+        if (!os_thread_join(threads[i], NULL)) {
+            fatal("%d wait failed: %v", i, os_get_error_string(os_get_last_error()));
+        }
+    }
+
+    if (opt.mode == MATCH_MODE_FUZZY) {
+        // the workers are gone, their arenas are free to use
+        fuzzy_merge(&workers[0].arena);
+    }
+
+    //os_wait_t res = os_wait_on_handles(threads, opt.j, true, INFINITE);
+    //if (res.result == OS_WAIT_FAILED) {
+        //fatal("wait failed: %v", os_get_error_string(os_get_last_error()));
+    //}
+    //app.should_print = res.result == OS_WAIT_FINISHED;
+    app.should_print = true;
+    return false;
+}
+
+void app_event(termevent_t *e, void *udata) {
+    if (e->type == TERM_EVENT_KEY &&
+        strv_equals(strv(e->value), strv("q"))
+       ) {
+
+        // for (usize i = 0; i < opt.j; ++i) {
+        //     arena__print_crash(&workers[i].arena);
+        //     arena__print_crash(&workers[i].scratch);
+        // }
+    
+        walk_cancel(CANCEL_USER);
+        app.finished = true;
+    }
+    // return false;
+    
+    // return app.finished;
+}
+
+void app_print_stats(outstream_t *out) {
+    f64 tps = (f64)term__get_ticks_per_second();
+    u64 total_steals = 0;
+    u64 total_entries = 0;
+
+    ostr_print(out, "\n\n<grey>thread      jobs     steals     failed    parks    idle ms</>");
+    for (int i = 0; i < opt.j; ++i) {
+        worker_t *w = &workers[i];
+        ostr_print(
+            out,
+            "\n%6d %9llu %10llu %10llu %8llu %10.1f",
+            i,
+            w->jobs_done,
+            w->steals,
+            w->failed_steals,
+            w->parks,
+            (f64)w->idle_ticks * 1000.0 / tps
+        );
+        total_steals += w->steals;
+        total_entries += w->entries;
+    }
+    ostr_print(out, "\n<grey>total steals:</> %llu", total_steals);
+
+    if (cancel_reason != CANCEL_NONE) {
+        ostr_print(out, "\n<grey>stopped early:</> %s, %ld jobs left pending", cancel_names[cancel_reason], pending_jobs);
+    }
+
+    if (!str_is_empty(opt.content)) {
+        u64 read = 0, mapped = 0, binary = 0;
+        for (int i = 0; i < opt.j; ++i) {
+            read += workers[i].content_read;
+            mapped += workers[i].content_mapped;
+            binary += workers[i].content_binary;
+        }
+        ostr_print(out, "\n<grey>content:</> %llu files read, %llu mapped, %llu binary skipped", read, mapped, binary);
+    }
+
+    if (opt.filters) {
+        u64 issued = 0, avoided = 0;
+        for (int i = 0; i < opt.j; ++i) {
+            issued += workers[i].stats_issued;
+            avoided += workers[i].stats_avoided;
+        }
+        ostr_print(out, "\n<grey>metadata:</> %llu stat calls issued, %llu avoided", issued, avoided);
+    }
+
+    if (opt.walker == WALKER_ASYNC) {
+        u64 reads = 0, max_inflight = 0;
+        for (int i = 0; i < opt.j; ++i) {
+            reads += workers[i].async_reads;
+            max_inflight = MAX(max_inflight, workers[i].async_max_inflight);
+        }
+        ostr_print(out, "\n<grey>async:</> %llu directory reads, up to %llu in flight per thread", reads, max_inflight);
+    }
+
+    if (opt.follow) {
+        u64 lookups = 0, cycles = 0, dupes = 0;
+        i64 ticks = 0;
+        for (int i = 0; i < opt.j; ++i) {
+            lookups += workers[i].visited_count;
+            ticks += workers[i].visited_ticks;
+            cycles += workers[i].link_cycles;
+            dupes += workers[i].link_dupes;
+        }
+        ostr_print(
+            out,
+            "\n<grey>links:</> %llu visited set lookups in %.1f ms across threads, %llu directories seen twice, %llu duplicate files",
+            lookups,
+            (f64)ticks * 1000.0 / tps,
+            cycles,
+            dupes
+        );
+    }
+
+    if (opt.max_depth || opt.min_depth || opt.one_file_system) {
+        u64 depth = 0, volume = 0, hidden = 0;
+        for (int i = 0; i < opt.j; ++i) {
+            depth += workers[i].pruned_depth;
+            volume += workers[i].pruned_volume;
+            hidden += workers[i].hidden_min_depth;
+        }
+        ostr_print(
+            out,
+            "\n<grey>pruned:</> %llu directories by --max-depth, %llu by --one-file-system, %llu entries hidden by --min-depth",
+            depth,
+            volume,
+            hidden
+        );
+    }
+
+    u64 batches = 0, wake_locks = 0, wake_locks_unbatched = 0;
+    for (int i = 0; i < opt.j; ++i) {
+        batches += workers[i].batches_published;
+        wake_locks += workers[i].wake_locks;
+        wake_locks_unbatched += workers[i].wake_locks_unbatched;
+    }
+    ostr_print(
+        out,
+        "\n<grey>job batches:</> %llu published, park lock taken %llu times (%llu one job at a time)",
+        batches,
+        wake_locks,
+        wake_locks_unbatched
+    );
+
+    u64 carved = 0, reused = 0, slab_bytes = 0;
+    for (int i = 0; i < opt.j; ++i) {
+        carved += workers[i].pool_carved;
+        reused += workers[i].pool_reused;
+        slab_bytes += workers[i].pool_slab_bytes;
+    }
+    ostr_print(
+        out,
+        "\n<grey>job pool:</> %llu blocks carved from %llu KB of slabs, %llu reused, %llu batches shared, %llu taken back",
+        carved,
+        slab_bytes / 1024,
+        reused,
+        pool.batches_given,
+        pool.batches_taken
+    );
+
+    if (!opt.no_ignore) {
+        u64 ignore_files = 0;
+        u64 ignored = 0;
+        for (int i = 0; i < opt.j; ++i) {
+            ignore_files += workers[i].ignore_files;
+            ignored += workers[i].ignored;
+        }
+        ostr_print(out, "\n<grey>ignore:</> %llu files loaded, %llu entries skipped", ignore_files, ignored);
+    }
+    ostr_print(out, "\n<grey>name matcher:</> %v", match_isa_names[matcher.isa]);
+
+    if (opt.mode == MATCH_MODE_REGEX) {
+        int dfa_states = 0;
+        u64 dfa_flushes = 0;
+        for (int i = 0; i < opt.j; ++i) {
+            dfa_states += workers[i].dfa->count;
+            dfa_flushes += workers[i].dfa->flushes;
+        }
+        ostr_print(
+            out, 
+            "\n<grey>regex:</> %d nfa states, %d dfa states across threads, %llu cache flushes, prefilter \"%v\"", 
+            regex.count, 
+            dfa_states, 
+            dfa_flushes, 
+            regex.prefilter.needle
+        );
+    }
+
+    f64 walk_sec = (f64)(walk_end - walk_begin) / tps;
+    ostr_print(
+        out,
+        "\n<grey>%s walker:</> %llu entries in %.1f ms (%.0f entries/s)",
+        walker_names[opt.walker],
+        total_entries,
+        walk_sec * 1000.0,
+        walk_sec > 0.0 ? (f64)total_entries / walk_sec : 0.0
+    );
+}
+
+void app_print_fuzzy(arena_t *arena, outstream_t *out) {
+    usize *positions = alloc(arena, usize, opt.tofind.len);
+
+    for (int i = 0; i < fuzzy_results_count; ++i) {
+        fuzzyhit_t *hit = &fuzzy_results[i];
+        strview_t path = strv(hit->path);
+
+        strview_t icon;
+        if (hit->is_dir) {
+            icon = icons[ICON_STYLE_NERD][ICON_FOLDER];
+        }
+        else {
+            strview_t ext;
+            os_file_split_path(path, NULL, NULL, &ext);
+            icon = ext_to_ico(ext);
+        }
+
+        ostr_print(out, "<green>%v</> <grey>%5d</> ", icon, hit->score);
+
+        fuzzy_score(strv(opt.tofind), path, !opt.case_sensitive, positions);
+
+        // group the matched characters in runs so we don't emit a tag per char
+        usize prev = 0;
+        for (usize k = 0; k < opt.tofind.len;) {
+            usize run_start = positions[k];
+            usize run_end = run_start + 1;
+            while (++k < opt.tofind.len && positions[k] == run_end) {
+                run_end++;
+            }
+            ostr_print(
+                out, 
+                "<grey>%v<green>%v", 
+                strv_sub(path, prev, run_start), 
+                strv_sub(path, run_start, run_end)
+            );
+            prev = run_end;
+        }
+        ostr_print(out, "<grey>%v</>\n", strv_sub(path, prev, SIZE_MAX));
+    }
+}
+
+str_t app_view(arena_t *arena, void *udata) {
+    outstream_t out = ostr_init(arena);
+
+    if (app.should_print) {
+        if (opt.mode == MATCH_MODE_FUZZY) {
+            app_print_fuzzy(arena, &out);
+        }
+
+        for (int i = 0; i < opt.j; ++i) {
+            for_each (r, workers[i].results) {
+                for (usize k = 0; k < r->count; ++k) {
+                    result_t *res = &r->items[k];
+
+                    ostr_print(
+                        &out, 
+                        "<green>%v</> <grey>%v<yellow>%v<green>%v<yellow>%v</>",
+                        res->icon,
+                        res->before,
+                        res->name,
+                        res->match,
+                        res->after
+                    );
+
+                    if (opt.mode == MATCH_MODE_MULTI) {
+                        ostr_print(&out, " <magenta>[%v]</>", opt.patterns[res->pattern]);
+                    }
+
+                    ostr_putc(&out, '\n');
+                }
+            }
+        }
+
+        ostr_print(&out, "\nfound %llu/%llu", workers_found(), workers_checked());
+
+        if (opt.mode == MATCH_MODE_MULTI) {
+            for (int i = 0; i < opt.pattern_count; ++i) {
+                ostr_print(&out, "\n  <magenta>%v</>: %d", opt.patterns[i], pattern_found[i]);
+            }
+        }
+
+        if (opt.stats) {
+            app_print_stats(&out);
+        }
+
+        app.finished = true;
+    }
+    else {
+        ostr_print(
+            &out,
+            "<magenta>%v</> files checked: %llu", 
+            app.spinner.frames[app.spinner.cur], 
+            workers_checked()
+        );
+    }
+
+    return ostr_to_str(&out);
+    // return STR_EMPTY;
+}
+
+// == INDEX ===============
+//
+// --index keeps a snapshot of the tree on disk so repeated searches don't have
+// to list every directory again. the file is a header followed by one record
+// per directory, in the order a depth first walk with sorted children visits
+// them (the same as sorting the paths with '/' before every other byte):
+//
+//   varint shared, varint len, bytes   path, front coded against the previous one
+//   u64 mtime                          last write time of the directory
+//   varint count                       number of entries
+//   per entry:
+//     varint shared, varint (len << 2 | is_link << 1 | is_dir), bytes
+//                                      name, front coded against the previous one
+//
+// refreshing walks the tree in that same order while reading the old index
+// alongside it: a directory whose mtime didn't change takes its entries from
+// the old record and only needs a stat, the rest get listed again. subdirectories
+// of a listed directory come with their mtime, so they don't even need the stat.
+// searching is then a linear scan of the mapped file with the usual matchers.
+// links are kept as names but never listed, the same as the walker without -L
+
+#define INDEX_VERSION  2
+#define INDEX_PATH_MAX KB(96)
+
+enum {
+    INDEX_FLAG_ALL_DIRS = 1 << 0,
+};
+
+typedef struct indexheader_t indexheader_t;
+struct indexheader_t {
+    char magic[4];
+    u32 version;
+    u32 flags;
+    u32 root_len;
+    u64 dir_count;
+    u64 entry_count;
+};
+
+typedef struct indexreader_t indexreader_t;
+struct indexreader_t {
+    const u8 *cur;
+    const u8 *end;
+    u64 dirs_left;
+    u64 names_left;
+    bool valid;
+    str_t dir;
+    str_t name;
+    bool is_dir;
+    bool is_link;
+    u64 mtime;
+};
+
+typedef struct indexentry_t indexentry_t;
+struct indexentry_t {
+    strview_t name;
+    bool is_dir;
+    bool is_link;
+    // 0 when we don't know it without a stat
+    u64 mtime;
+};
+
+typedef struct indexctx_t indexctx_t;
+struct indexctx_t {
+    worker_t *data;
+    indexreader_t old;
+    // sorted list of the only directories that may have changed, when set
+    // nothing else gets a stat
+    strview_t *dirty;
+    usize dirty_count;
+    outstream_t out;
+    str_t prev_dir;
+    u64 dir_count;
+    u64 entry_count;
+    // stats
+    u64 reused;
+    u64 relisted;
+    u64 stats;
+};
+
+u64 index__filetime(LARGE_INTEGER time) {
+    return (u64)time.QuadPart;
+}
+
+// paths compare component by component, which is the same as treating '/' as
+// the smallest byte. that's the order the depth first walk produces
+int index__cmp_path(strview_t a, strview_t b) {
+    usize len = MIN(a.len, b.len);
+    for (usize i = 0; i < len; ++i) {
+        u8 ca = a.buf[i] == '/' ? 0 : (u8)a.buf[i];
+        u8 cb = b.buf[i] == '/' ? 0 : (u8)b.buf[i];
+        if (ca != cb) {
+            return ca < cb ? -1 : 1;
+        }
+    }
+    return a.len < b.len ? -1 : a.len > b.len;
+}
+
+int index__cmp_entries(const void *a, const void *b) {
+    const indexentry_t *ea = a;
+    const indexentry_t *eb = b;
+    usize len = MIN(ea->name.len, eb->name.len);
+    int cmp = memcmp(ea->name.buf, eb->name.buf, len);
+    if (cmp) return cmp;
+    return ea->name.len < eb->name.len ? -1 : ea->name.len > eb->name.len;
+}
+
+usize index__shared(strview_t a, strview_t b) {
+    usize len = MIN(a.len, b.len);
+    usize i = 0;
+    while (i < len && a.buf[i] == b.buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+// full path of a directory inside the index, relative paths are kept without
+// opt.dir, which always ends with a slash
+str_t index__full_path(arena_t *arena, strview_t rel) {
+    return str_fmt(arena, "%v%v", opt.dir, rel);
+}
+
+// -- reading --
+
+bool index__get_varint(indexreader_t *r, u64 *out) {
+    u64 value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (r->cur >= r->end) {
+            return false;
+        }
+        u8 byte = *r->cur++;
+        value |= (u64)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *out = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+// decodes a front coded string into buf, which has INDEX_PATH_MAX bytes
+bool index__get_coded(indexreader_t *r, str_t *buf, u64 shared, u64 len) {
+    if (shared > buf->len || shared + len > INDEX_PATH_MAX || len > (u64)(r->end - r->cur)) {
+        return false;
+    }
+    memcpy(buf->buf + shared, r->cur, len);
+    buf->len = shared + len;
+    r->cur += len;
+    return true;
+}
+
+bool index__next_name(indexreader_t *r) {
+    if (!r->valid || !r->names_left) {
+        return false;
+    }
+
+    u64 shared, len;
+    if (!index__get_varint(r, &shared) || 
+        !index__get_varint(r, &len) ||
+        !index__get_coded(r, &r->name, shared, len >> 2)
+    ) {
+        r->valid = false;
+        return false;
+    }
+
+    r->is_dir = len & 1;
+    r->is_link = (len >> 1) & 1;
+    r->names_left--;
+    return true;
+}
+
+bool index__next_dir(indexreader_t *r) {
+    while (index__next_name(r)) {
+        // skip whatever is left of the current directory
+    }
+
+    if (!r->valid || !r->dirs_left) {
+        r->valid = false;
+        return false;
+    }
+
+    u64 shared, len;
+    if (!index__get_varint(r, &shared) || 
+        !index__get_varint(r, &len) ||
+        !index__get_coded(r, &r->dir, shared, len) ||
+        (r->end - r->cur) < (isize)sizeof(u64)
+    ) {
+        r->valid = false;
+        return false;
+    }
+
+    memcpy(&r->mtime, r->cur, sizeof(u64));
+    r->cur += sizeof(u64);
+
+    // every name takes at least two bytes, anything bigger is garbage
+    if (!index__get_varint(r, &r->names_left) || r->names_left > (u64)(r->end - r->cur) / 2) {
+        r->valid = false;
+        return false;
+    }
+
+    r->name.len = 0;
+    r->dirs_left--;
+    return true;
+}
+
+indexreader_t index__reader_init(arena_t *arena, strview_t data, strview_t root_dir) {
+    indexreader_t r = {
+        .dir.buf = alloc(arena, char, INDEX_PATH_MAX),
+        .name.buf = alloc(arena, char, INDEX_PATH_MAX),
+    };
+
+    if (data.len < sizeof(indexheader_t)) {
+        return r;
+    }
+
+    indexheader_t header;
+    memcpy(&header, data.buf, sizeof(header));
+
+    strview_t root = strv_sub(data, sizeof(header), sizeof(header) + header.root_len);
+    u32 flags = opt.all_dirs ? INDEX_FLAG_ALL_DIRS : 0;
+
+    // anything that doesn't look like the index for this exact search is thrown away
+    if (memcmp(header.magic, "FDIX", 4) != 0 || 
+        header.version != INDEX_VERSION || 
+        header.flags != flags ||
+        !strv_equals(root, root_dir)
+    ) {
+        return r;
+    }
+
+    r.cur = (const u8 *)root.buf + root.len;
+    r.end = (const u8 *)data.buf + data.len;
+    r.dirs_left = header.dir_count;
+    r.valid = true;
+    index__next_dir(&r);
+    return r;
+}
+
+// -- writing --
+
+void index__put_varint(outstream_t *out, u64 value) {
+    while (value >= 0x80) {
+        ostr_putc(out, (char)(value | 0x80));
+        value >>= 7;
+    }
+    ostr_putc(out, (char)value);
+}
+
+void index__write_dir(indexctx_t *ctx, strview_t rel, u64 mtime, indexentry_t *entries, usize count) {
+    usize shared = index__shared(strv(ctx->prev_dir), rel);
+    index__put_varint(&ctx->out, shared);
+    index__put_varint(&ctx->out, rel.len - shared);
+    ostr_puts(&ctx->out, strv_sub(rel, shared, SIZE_MAX));
+    ostr_puts(&ctx->out, strv((char *)&mtime, sizeof(mtime)));
+    index__put_varint(&ctx->out, count);
+
+    memcpy(ctx->prev_dir.buf, rel.buf, rel.len);
+    ctx->prev_dir.len = rel.len;
+
+    strview_t prev = STRV_EMPTY;
+    for (usize i = 0; i < count; ++i) {
+        strview_t name = entries[i].name;
+        usize name_shared = index__shared(prev, name);
+        index__put_varint(&ctx->out, name_shared);
+        index__put_varint(&ctx->out, ((u64)(name.len - name_shared) << 2) | (entries[i].is_link << 1) | entries[i].is_dir);
+        ostr_puts(&ctx->out, strv_sub(name, name_shared, SIZE_MAX));
+        prev = name;
+    }
+
+    ctx->dir_count++;
+    ctx->entry_count += count;
+}
+
+// -- refreshing --
+
+bool index__stat(arena_t scratch, strview_t rel, u64 *mtime) {
+    str_t path = index__full_path(&scratch, rel);
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if (!GetFileAttributesExW(path_to_wide(&scratch, strv(path)), GetFileExInfoStandard, &attr)) {
+        return false;
+    }
+    *mtime = ((u64)attr.ftLastWriteTime.dwHighDateTime << 32) | attr.ftLastWriteTime.dwLowDateTime;
+    return true;
+}
+
+usize index__list(indexctx_t *ctx, arena_t *arena, strview_t rel, indexentry_t **out) {
+    str_t path = index__full_path(arena, rel);
+    HANDLE dir = dir_open_at(*arena, NULL, strv(path));
+    if (!dir) {
+        return 0;
+    }
+
+    usize count = 0;
+    usize cap = 64;
+    indexentry_t *entries = alloc(arena, indexentry_t, cap);
+    char name_buf[MAX_PATH * 4];
+
+    while (GetFileInformationByHandleEx(dir, FileFullDirectoryInfo, ctx->data->walk_buf, WALK_BUFFER_SIZE)) {
+        u8 *cur = ctx->data->walk_buf;
+
+        while (true) {
+            FILE_FULL_DIR_INFO *info = (FILE_FULL_DIR_INFO *)cur;
+
+            int name_len = WideCharToMultiByte(
+                CP_UTF8, 0, 
+                info->FileName, (int)(info->FileNameLength / sizeof(WCHAR)), 
+                name_buf, sizeof(name_buf), 
+                NULL, NULL
+            );
+            strview_t name = strv(name_buf, name_len);
+            bool is_dir = info->FileAttributes & FILE_ATTRIBUTE_DIRECTORY;
+            entrymeta_t meta = {
+                .attributes = info->FileAttributes,
+                .reparse_tag = (info->FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) ? info->EaSize : 0,
+            };
+
+            bool skip = strv_equals(name, CURDIR) || strv_equals(name, PREVDIR) ||
+                        (is_dir && !opt.all_dirs && name.buf[0] == '.');
+
+            if (!skip) {
+                if (count >= cap) {
+                    indexentry_t *grown = alloc(arena, indexentry_t, cap * 2);
+                    memcpy(grown, entries, sizeof(indexentry_t) * count);
+                    entries = grown;
+                    cap *= 2;
+                }
+                entries[count++] = (indexentry_t){
+                    .name = strv(str(arena, name)),
+                    .is_dir = is_dir,
+                    .is_link = entry_is_link(&meta),
+                    .mtime = is_dir ? index__filetime(info->LastWriteTime) : 0,
+                };
+            }
+
+            if (info->NextEntryOffset == 0) {
+                break;
+            }
+            cur += info->NextEntryOffset;
+        }
+    }
+
+    CloseHandle(dir);
+
+    qsort(entries, count, sizeof(indexentry_t), index__cmp_entries);
+    *out = entries;
+    return count;
+}
+
+int index__cmp_dirty(const void *a, const void *b) {
+    return index__cmp_path(*(const strview_t *)a, *(const strview_t *)b);
+}
+
+bool index__is_dirty(indexctx_t *ctx, strview_t rel) {
+    return bsearch(&rel, ctx->dirty, ctx->dirty_count, sizeof(strview_t), index__cmp_dirty) != NULL;
+}
+
+void index__refresh_dir(indexctx_t *ctx, arena_t scratch, strview_t rel, u64 mtime) {
+    indexreader_t *old = &ctx->old;
+
+    // directories the old index has before this one don't exist anymore
+    while (old->valid && index__cmp_path(strv(old->dir), rel) < 0) {
+        index__next_dir(old);
+    }
+
+    indexentry_t *entries = NULL;
+    usize count = 0;
+
+    bool found = old->valid && index__cmp_path(strv(old->dir), rel) == 0;
+    bool reuse = false;
+
+    if (ctx->dirty) {
+        reuse = found && !index__is_dirty(ctx, rel);
+        if (reuse) {
+            mtime = old->mtime;
+        }
+        else if (!mtime) {
+            index__stat(scratch, rel, &mtime);
+        }
+    }
+    else {
+        reuse = found && old->mtime == mtime;
+    }
+
+    if (reuse) {
+        entries = alloc(&scratch, indexentry_t, old->names_left);
+        while (index__next_name(old)) {
+            entries[count++] = (indexentry_t){
+                .name = strv(str(&scratch, strv(old->name))),
+                .is_dir = old->is_dir,
+                .is_link = old->is_link,
+            };
+        }
+        ctx->reused++;
+    }
+    else {
+        count = index__list(ctx, &scratch, rel, &entries);
+        ctx->relisted++;
+    }
+
+    index__write_dir(ctx, rel, mtime, entries, count);
+
+    // a link could lead back up the tree or onto another volume, it's only a name
+    for (usize i = 0; i < count; ++i) {
+        if (!entries[i].is_dir || entries[i].is_link) {
+            continue;
+        }
+
+        strview_t child = rel.len ? strv(str_fmt(&scratch, "%v/%v", rel, entries[i].name)) : entries[i].name;
+        u64 child_mtime = entries[i].mtime;
+
+        if (!child_mtime && !ctx->dirty) {
+            ctx->stats++;
+            if (!index__stat(scratch, child, &child_mtime)) {
+                continue;
+            }
+        }
+
+        index__refresh_dir(ctx, scratch, child, child_mtime);
+    }
+}
+
+str_t index__refresh(indexctx_t *ctx, arena_t *arena) {
+    arena_t scratch = ctx->data->scratch;
+    ctx->out = ostr_init(arena);
+    ctx->prev_dir = (str_t){ .buf = alloc(&scratch, char, INDEX_PATH_MAX) };
+
+    indexheader_t header = {
+        .magic = { 'F', 'D', 'I', 'X' },
+        .version = INDEX_VERSION,
+        .flags = opt.all_dirs ? INDEX_FLAG_ALL_DIRS : 0,
+        .root_len = (u32)opt.dir.len,
+    };
+    ostr_puts(&ctx->out, strv((char *)&header, sizeof(header)));
+    ostr_puts(&ctx->out, strv(opt.dir));
+
+    u64 root_mtime = 0;
+    if (index__stat(scratch, STRV_EMPTY, &root_mtime)) {
+        index__refresh_dir(ctx, scratch, STRV_EMPTY, root_mtime);
+    }
+
+    str_t out = ostr_to_str(&ctx->out);
+    header.dir_count = ctx->dir_count;
+    header.entry_count = ctx->entry_count;
+    memcpy(out.buf, &header, sizeof(header));
+    return out;
+}
+
+// -- searching --
+
+// root_dir is the directory the index was built for, the printed paths start
+// with opt.dir
+void index__scan(worker_t *data, arena_t *arena, strview_t index, strview_t root_dir) {
+    indexreader_t r = index__reader_init(arena, index, root_dir);
+    char *path_buf = alloc(arena, char, INDEX_PATH_MAX * 2);
+
+    // same paths the walker prints, without the leading "./"
+    strview_t root = strv(opt.dir);
+    if (root.len >= 2 && root.buf[0] == '.' && (root.buf[1] == '/' || root.buf[1] == '\\')) {
+        root = strv_remove_prefix(root, 2);
+    }
+    memcpy(path_buf, root.buf, root.len);
+    usize root_len = root.len;
+
+    while (r.valid && !walk_cancelled()) {
+        // the index has the whole tree, depth limits just skip directories
+        if (opt.max_depth || opt.min_depth) {
+            int depth = r.dir.len ? 2 : 1;
+            for (usize i = 0; i < r.dir.len; ++i) {
+                depth += r.dir.buf[i] == '/';
+            }
+            if (depth < opt.min_depth || (opt.max_depth && depth > opt.max_depth)) {
+                index__next_dir(&r);
+                continue;
+            }
+        }
+
+        memcpy(path_buf + root_len, r.dir.buf, r.dir.len);
+        usize prefix_len = root_len + r.dir.len;
+        if (r.dir.len) {
+            path_buf[prefix_len++] = '/';
+        }
+
+        while (index__next_name(&r)) {
+            data->checked++;
+
+            strview_t name = strv(r.name);
+            memcpy(path_buf + prefix_len, name.buf, name.len);
+            strview_t path = strv(path_buf, prefix_len + name.len);
+
+            if (opt.mode == MATCH_MODE_FUZZY) {
+                i32 score = fuzzy_score(strv(opt.tofind), path, !opt.case_sensitive, NULL);
+                if (score != FUZZY_NO_MATCH && filter_match(data, NULL, path, name, r.is_dir, NULL)) {
+                    data->found++;
+                    fuzzyheap_push(&data->arena, data->fuzzy, score, path, r.is_dir);
+                }
+                continue;
+            }
+
+            match_t m = {0};
+            if (!name_match(data, name, &m) || !filter_match(data, NULL, path, name, r.is_dir, NULL)) {
+                continue;
+            }
+
+            if (!result_claim(data)) {
+                break;
+            }
+            if (opt.mode == MATCH_MODE_MULTI) {
+                ATOMIC_INC(pattern_found[m.pattern]);
+            }
+
+            if (opt.sorted) {
+                sorted_push(data, path, m.pattern);
+            }
+            else if (opt.exec_count) {
+                exec_push(path);
+            }
+            else {
+                output_line(data, path, m.pattern);
+            }
+        }
+
+        index__next_dir(&r);
+    }
+
+    if (opt.sorted) {
+        sorted_sort(data);
+    }
+    else {
+        output_flush(data);
+    }
+}
+
+int stream_finish(arena_t *arena);
+void stream_print_totals(outstream_t *out);
+
+int index_run(arena_t *arena) {
+    worker_t *data = &workers[0];
+    i64 begin = term__get_ticks();
+
+    // the old index is mapped and read straight from the page cache
+    strview_t old = STRV_EMPTY;
+    HANDLE fp = CreateFileW(
+        path_to_wide(arena, strv(opt.index)),
+        GENERIC_READ,
+        FILE_SHARE_READ,
+        NULL,
+        OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN,
+        NULL
+    );
+    HANDLE mapping = NULL;
+    const u8 *view = NULL;
+
+    if (fp != INVALID_HANDLE_VALUE) {
+        LARGE_INTEGER size = {0};
+        GetFileSizeEx(fp, &size);
+        mapping = size.QuadPart ? CreateFileMappingW(fp, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+        view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+        if (view) {
+            old = strv((const char *)view, (usize)size.QuadPart);
+        }
+    }
+
+    indexctx_t ctx = { .data = data };
+    str_t fresh = STR_EMPTY;
+    strview_t index = old;
+
+    ctx.old = index__reader_init(arena, old, strv(opt.dir));
+    bool usable = ctx.old.valid;
+
+    if (!opt.no_refresh || !usable) {
+        fresh = index__refresh(&ctx, arena);
+        index = strv(fresh);
+    }
+
+    i64 refreshed = term__get_ticks();
+
+    index__scan(data, arena, index, strv(opt.dir));
+
+    i64 scanned = term__get_ticks();
+
+    if (view) UnmapViewOfFile(view);
+    if (mapping) CloseHandle(mapping);
+    if (fp != INVALID_HANDLE_VALUE) CloseHandle(fp);
+
+    // only touch the file when something actually changed
+    bool changed = fresh.len && !(fresh.len == old.len && memcmp(fresh.buf, old.buf, old.len) == 0);
+    if (changed && !os_file_write_all_str(strv(opt.index), strv(fresh))) {
+        warn("couldn't write index to %v", opt.index);
+    }
+
+    int result = stream_finish(arena);
+
+    if (opt.stats) {
+        f64 tps = (f64)term__get_ticks_per_second();
+        outstream_t out = ostr_init(arena);
+        ostr_print(
+            &out,
+            "\n<grey>index:</> %llu bytes, %llu directories listed, %llu reused, %llu stats%s"
+            "\n<grey>refresh:</> %.1f ms <grey>scan:</> %.1f ms\n",
+            (u64)index.len,
+            ctx.relisted,
+            ctx.reused,
+            ctx.stats,
+            changed ? ", rewritten" : "",
+            (f64)(refreshed - begin) * 1000.0 / tps,
+            (f64)(scanned - refreshed) * 1000.0 / tps
+        );
+        stream_print_totals(&out);
+        output_stats(*arena, ostr_as_view(&out));
+    }
+
+    return result;
+}
 
-    if (!os_mutex_try_lock(jobs_mutex)) {
-        return false;
+int stream_finish(arena_t *arena) {
+    bool exec_ok = true;
+    if (opt.exec_count) {
+        exec_ok = exec_finish();
     }
 
-    bool finished = ATOMIC_GET(jobs_in_progess) <= 0 && !jobs;
+    if (opt.sorted) {
+        sorted_merge(&workers[0]);
+    }
+    else if (opt.mode == MATCH_MODE_FUZZY) {
+        // the ranking is only known at the end, reuse the first worker's buffer
+        fuzzy_merge(arena);
+        for (int i = 0; i < fuzzy_results_count; ++i) {
+            output_line(&workers[0], strv(fuzzy_results[i].path), -1);
+        }
+        output_flush(&workers[0]);
+    }
 
-    os_mutex_unlock(jobs_mutex);
+    if (opt.stats && str_is_empty(opt.index)) {
+        outstream_t out = ostr_init(arena);
+        app_print_stats(&out);
+        ostr_putc(&out, '\n');
+        stream_print_totals(&out);
+        output_stats(*arena, ostr_as_view(&out));
+    }
 
-    if (!finished) return false;
+    return exec_ok ? 0 : 1;
+}
 
-    ATOMIC_SET(should_quit, 1);
-    os_cond_broadcast(job_notif);
+void stream_print_totals(outstream_t *out) {
+    u64 records = 0;
+    for (int i = 0; i < opt.j; ++i) {
+        records += workers[i].out_records;
+    }
 
-    if (app.should_print) return true;
-    
+    // from the start of the walk to the last write, what a reader on the pipe sees
+    f64 seconds = (f64)(term__get_ticks() - output.begin) / (f64)term__get_ticks_per_second();
+    seconds = MAX(seconds, 1e-9);
+    ostr_print(
+        out,
+        "<grey>output:</> %llu writes, %llu bytes, %llu records in %.1f ms, %.1f MB/s, %.0f records/s\n",
+        output.writes,
+        output.bytes,
+        records,
+        seconds * 1000.0,
+        (f64)output.bytes / (1024.0 * 1024.0) / seconds,
+        (f64)records / seconds
+    );
+    if (opt.exec_count) {
+        ostr_print(out, "<grey>exec:</> %llu commands for %llu paths, %llu failed, queue full %llu times\n", exec.commands, exec.paths, exec.failed, exec.full_waits);
+    }
+}
+
+int stream_run(arena_t *arena) {
     for (int i = 0; i < opt.j; ++i) {
         if (!os_thread_join(threads[i], NULL)) {
             fatal("%d wait failed: %v", i, os_get_error_string(os_get_last_error()));
         }
     }
 
-    //os_wait_t res = os_wait_on_handles(threads, opt.j, true, INFINITE);
-    //if (res.result == OS_WAIT_FAILED) {
-        //fatal("wait failed: %v", os_get_error_string(os_get_last_error()));
-    //}
-    //app.should_print = res.result == OS_WAIT_FINISHED;
-    app.should_print = true;
-    return false;
+    return stream_finish(arena);
 }
 
-void app_event(termevent_t *e, void *udata) {
-    if (e->type == TERM_EVENT_KEY &&
-        strv_equals(strv(e->value), strv("q"))
-       ) {
+// compiles whatever the current options search for into the global matchers
+void search_compile(arena_t *arena) {
+    opt.tofind_original = str_dup(arena, opt.tofind);
 
-        // for (usize i = 0; i < opt.j; ++i) {
-        //     arena__print_crash(&data[i].arena);
-        //     arena__print_crash(&data[i].scratch);
-        // }
-    
-        app.finished = true;
+    if (!opt.case_sensitive) {
+        str_upper(&opt.tofind);
+    }
+
+    match_isa_e isa = match_detect_isa();
+    if (opt.force_isa) {
+        if (opt.isa > isa) {
+            options_fatal("%v is not supported on this cpu", match_isa_names[opt.isa]);
+        }
+        isa = opt.isa;
+    }
+    matcher = matcher_make(strv(opt.tofind), !opt.case_sensitive, isa);
+
+    if (opt.mode == MATCH_MODE_GLOB) {
+        globs = glob_compile(arena, strv(opt.tofind));
+    }
+    else if (opt.mode == MATCH_MODE_MULTI) {
+        aho = aho_compile(arena, opt.patterns, opt.pattern_count, !opt.case_sensitive);
+        pattern_found = alloc(arena, long, opt.pattern_count);
+    }
+    else if (opt.mode == MATCH_MODE_REGEX) {
+        // \w and friends would change meaning if upper cased, fold while compiling instead
+        regex = regex_compile(arena, strv(opt.tofind_original), !opt.case_sensitive, isa);
+    }
+
+    if (!str_is_empty(opt.content)) {
+        str_t needle = str_dup(arena, opt.content);
+        if (!opt.case_sensitive) {
+            str_upper(&needle);
+        }
+        content_matcher = matcher_make(strv(needle), !opt.case_sensitive, isa);
     }
-    // return false;
-    
-    // return app.finished;
 }
 
-str_t app_view(arena_t *arena, void *udata) {
-    outstream_t out = ostr_init(arena);
+// == DAEMON ==============
+//
+// fd --daemon -d <dir> keeps the index of <dir> in memory and answers searches
+// over a named pipe. a watcher thread sits on ReadDirectoryChangesW for the
+// whole tree and turns every create, delete and rename into "this directory
+// changed". before a search is answered only those directories are listed
+// again through the index refresh, the rest of the tree is reused without even
+// a stat. if the change buffer overflows we lost track of what happened and do
+// a full mtime based refresh instead
+//
+// the cli sends its command line to the pipe named after the absolute path of
+// -dir, the daemon parses it the same way main does and streams the matches
+// back. when there is no daemon, or it can't serve that search, the cli just
+// walks the tree like before
 
-    if (app.should_print) {
-        for (int i = 0; i < opt.j; ++i) {
-            for_each (r, data[i].results) {
-                for (usize k = 0; k < r->count; ++k) {
-                    result_t *res = &r->items[k];
+#define DAEMON_MAX_DIRTY     4096
+#define DAEMON_DIRTY_POOL    KB(512)
+#define DAEMON_NOTIFY_BUFFER KB(64)
+#define DAEMON_PIPE_BUFFER   KB(64)
+#define DAEMON_MAX_REQUEST   KB(64)
 
-                    ostr_print(
-                        &out, 
-                        "<green>%v</> <grey>%v<yellow>%v<green>%v<yellow>%v</>\n",
-                        res->icon,
-                        res->before,
-                        res->name,
-                        opt.tofind_original,
-                        res->after
-                    );
+typedef struct dirtyset_t dirtyset_t;
+struct dirtyset_t {
+    strview_t paths[DAEMON_MAX_DIRTY];
+    int count;
+    char pool[DAEMON_DIRTY_POOL];
+    usize pool_len;
+    bool overflow;
+};
+
+struct {
+    oshandle_t mtx;
+    // the watcher fills one set while the other one is being applied
+    dirtyset_t sets[2];
+    dirtyset_t *pending;
+    HANDLE root;
+    // the index is rebuilt from one arena into the other
+    arena_t arenas[2];
+    int cur;
+    str_t index;
+    u64 events;
+    u64 queries;
+} daemon = {0};
+
+void dirtyset__reset(dirtyset_t *set) {
+    set->count = 0;
+    set->pool_len = 0;
+    set->overflow = false;
+}
+
+void dirtyset__add(dirtyset_t *set, strview_t path) {
+    // builds tend to touch the same directory over and over
+    if (set->count && strv_equals(set->paths[set->count - 1], path)) {
+        return;
+    }
+
+    if (set->count >= DAEMON_MAX_DIRTY || (set->pool_len + path.len) > DAEMON_DIRTY_POOL) {
+        set->overflow = true;
+        return;
+    }
+
+    char *buf = set->pool + set->pool_len;
+    memcpy(buf, path.buf, path.len);
+    set->pool_len += path.len;
+    set->paths[set->count++] = strv(buf, path.len);
+}
+
+str_t daemon__pipe_name(arena_t *arena, strview_t dir) {
+    str_t dir_str = str(arena, dir);
+    char full[MAX_PATH * 4];
+    DWORD len = GetFullPathNameA(dir_str.buf, sizeof(full), full, NULL);
+    if (!len || len >= sizeof(full)) {
+        return STR_EMPTY;
+    }
+
+    // the same directory can be spelled in many ways, the hash shouldn't care
+    while (len > 1 && (full[len - 1] == '/' || full[len - 1] == '\\')) {
+        len--;
+    }
+
+    u64 hash = 14695981039346656037ull;
+    for (DWORD i = 0; i < len; ++i) {
+        char c = full[i] == '\\' ? '/' : char_lower(full[i]);
+        hash = (hash ^ (u8)c) * 1099511628211ull;
+    }
+
+    return str_fmt(arena, "\\\\.\\pipe\\fd-%016llx", hash);
+}
+
+int daemon__watcher(u64 id, void *udata) {
+    COLLA_UNUSED(id);
+    COLLA_UNUSED(udata);
+
+    static DWORD notify_buf[DAEMON_NOTIFY_BUFFER / sizeof(DWORD)];
+    char name_buf[MAX_PATH * 4];
+
+    while (true) {
+        DWORD bytes = 0;
+        BOOL ok = ReadDirectoryChangesW(
+            daemon.root,
+            notify_buf,
+            sizeof(notify_buf),
+            TRUE,
+            FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME,
+            &bytes,
+            NULL,
+            NULL
+        );
+
+        if (!ok) {
+            warn("stopped watching for changes: %v", os_get_error_string(os_get_last_error()));
+            return 1;
+        }
+
+        os_mutex_lock(daemon.mtx);
+
+        // zero bytes means the kernel buffer overflowed and events were dropped
+        if (bytes == 0) {
+            daemon.pending->overflow = true;
+        }
+
+        u8 *cur = (u8 *)notify_buf;
+        while (bytes) {
+            FILE_NOTIFY_INFORMATION *info = (FILE_NOTIFY_INFORMATION *)cur;
+
+            int name_len = WideCharToMultiByte(
+                CP_UTF8, 0,
+                info->FileName, (int)(info->FileNameLength / sizeof(WCHAR)),
+                name_buf, sizeof(name_buf),
+                NULL, NULL
+            );
+
+            // the directory that holds the entry is the one that has to be listed again
+            int parent_len = 0;
+            for (int i = 0; i < name_len; ++i) {
+                if (name_buf[i] == '\\') {
+                    name_buf[i] = '/';
+                    parent_len = i;
                 }
             }
+
+            dirtyset__add(daemon.pending, strv(name_buf, parent_len));
+            daemon.events++;
+
+            if (info->NextEntryOffset == 0) {
+                break;
+            }
+            cur += info->NextEntryOffset;
         }
 
-        ostr_print(&out, "\nfound %d/%d", found_count, checked_count);
-        app.finished = true;
+        os_mutex_unlock(daemon.mtx);
+    }
+}
+
+void daemon__apply(arena_t scratch) {
+    dirtyset_t *set = daemon.pending;
+    dirtyset_t *next = set == &daemon.sets[0] ? &daemon.sets[1] : &daemon.sets[0];
+
+    os_mutex_lock(daemon.mtx);
+        dirtyset__reset(next);
+        daemon.pending = next;
+    os_mutex_unlock(daemon.mtx);
+
+    if (!set->count && !set->overflow) {
+        return;
+    }
+
+    indexctx_t ctx = { .data = &workers[0] };
+    ctx.old = index__reader_init(&scratch, strv(daemon.index), strv(opt.dir));
+
+    if (!set->overflow) {
+        qsort(set->paths, set->count, sizeof(strview_t), index__cmp_dirty);
+        ctx.dirty = set->paths;
+        ctx.dirty_count = set->count;
+    }
+
+    int other = daemon.cur ^ 1;
+    arena_rewind(&daemon.arenas[other], 0);
+    daemon.index = index__refresh(&ctx, &daemon.arenas[other]);
+    daemon.cur = other;
+}
+
+bool daemon__read(HANDLE pipe, void *buf, usize len) {
+    u8 *cur = buf;
+    while (len) {
+        DWORD read = 0;
+        if (!ReadFile(pipe, cur, (DWORD)len, &read, NULL) || !read) {
+            return false;
+        }
+        cur += read;
+        len -= read;
+    }
+    return true;
+}
+
+// the index has every name with only what the daemon was started with, and
+// no ignore files. anything that needs more than names gets walked by the cli
+bool daemon__can_answer(const options_t *daemon_opt) {
+    return opt.all_dirs == daemon_opt->all_dirs &&
+           opt.no_ignore &&
+           !opt.filters &&
+           !opt.follow &&
+           !opt.one_file_system &&
+           !opt.exec_count &&
+           !opt.daemon &&
+           str_is_empty(opt.content) &&
+           str_is_empty(opt.index);
+}
+
+void daemon__serve(arena_t arena, HANDLE pipe) {
+    u32 len = 0;
+    if (!daemon__read(pipe, &len, sizeof(len)) || len > DAEMON_MAX_REQUEST) {
+        return;
+    }
+
+    char *request = alloc(&arena, char, len + 1);
+    if (!daemon__read(pipe, request, len)) {
+        return;
+    }
+
+    // the request is the client's command line, one null terminated argument after the other
+    int argc = 1;
+    for (u32 i = 0; i < len; ++i) {
+        argc += request[i] == '\0';
+    }
+    char **argv = alloc(&arena, char *, argc + 1);
+    argv[0] = "fd";
+    char *arg = request;
+    for (int i = 1; i < argc; ++i) {
+        argv[i] = arg;
+        arg += strlen(arg) + 1;
+    }
+
+    daemon__apply(arena);
+
+    options_t daemon_opt = opt;
+    optrecover_t recover = { .arena = &arena };
+    options_recover = &recover;
+
+    // status '1': here come the matches, '0': walk instead, '2': bad request,
+    // the error message follows
+    char status = '1';
+    if (setjmp(recover.jmp)) {
+        status = '2';
     }
     else {
-        ostr_print(
-            &out,
-            "<magenta>%v</> files checked: %d", 
-            app.spinner.frames[app.spinner.cur], 
-            ATOMIC_GET(checked_count)
+        opt = get_options(&arena, argc, argv);
+        if (!daemon__can_answer(&daemon_opt)) {
+            status = '0';
+        }
+        else {
+            search_compile(&arena);
+        }
+    }
+
+    options_recover = NULL;
+
+    DWORD written = 0;
+    bool sent = WriteFile(pipe, &status, 1, &written, NULL);
+    if (sent && status == '2') {
+        WriteFile(pipe, recover.error.buf, (DWORD)recover.error.len, &written, NULL);
+    }
+
+    if (!sent || status != '1') {
+        opt = daemon_opt;
+        return;
+    }
+
+    worker_t *data = &workers[0];
+    arena_t worker_arena = data->arena;
+
+    opt.stats = false;
+
+    data->dfa = opt.mode == MATCH_MODE_REGEX ? dfa_make(&data->arena) : NULL;
+    data->fuzzy = opt.mode == MATCH_MODE_FUZZY ? fuzzyheap_make(&data->arena) : NULL;
+    data->sorted = NULL;
+    data->sorted_count = 0;
+    data->sorted_cap = 0;
+    data->out_len = 0;
+    fuzzy_results_count = 0;
+    data->checked = 0;
+    data->found = 0;
+    results_claimed = 0;
+    should_quit = false;
+    walk_done = false;
+    cancel_reason = CANCEL_NONE;
+
+    output.handle = (oshandle_t){ (uptr)pipe };
+    output.closed = false;
+
+    index__scan(data, &arena, strv(daemon.index), strv(daemon_opt.dir));
+    stream_finish(&arena);
+
+    // everything else lives in the request's copy of the arena, the dfa
+    // reserves its own
+    if (data->dfa) {
+        dfa_free(data->dfa);
+        data->dfa = NULL;
+    }
+    data->arena = worker_arena;
+    opt = daemon_opt;
+    daemon.queries++;
+}
+
+int daemon_run(arena_t *arena) {
+    str_t pipe_name = daemon__pipe_name(arena, strv(opt.dir));
+    if (str_is_empty(pipe_name)) {
+        fatal("couldn't get the full path of %v", opt.dir);
+    }
+
+    daemon.mtx = os_mutex_create();
+    daemon.pending = &daemon.sets[0];
+    daemon.arenas[0] = arena_make(ARENA_VIRTUAL, GB(1));
+    daemon.arenas[1] = arena_make(ARENA_VIRTUAL, GB(1));
+
+    daemon.root = dir_open_at(*arena, NULL, strv(opt.dir));
+    if (!daemon.root) {
+        fatal("couldn't open %v: %v", opt.dir, os_get_error_string(os_get_last_error()));
+    }
+
+    // start watching before the first listing so nothing slips in between
+    os_thread_launch(daemon__watcher, NULL);
+
+    indexctx_t ctx = { .data = &workers[0] };
+    ctx.old = index__reader_init(arena, STRV_EMPTY, strv(opt.dir));
+    daemon.index = index__refresh(&ctx, &daemon.arenas[0]);
+
+    WCHAR *wname = path_to_wide(arena, strv(pipe_name));
+    DWORD first = FILE_FLAG_FIRST_PIPE_INSTANCE;
+
+    println("watching %v (%llu directories, %llu entries) on %v", opt.dir, ctx.dir_count, ctx.entry_count, pipe_name);
+
+    while (true) {
+        HANDLE pipe = CreateNamedPipeW(
+            wname,
+            PIPE_ACCESS_DUPLEX | first,
+            PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+            PIPE_UNLIMITED_INSTANCES,
+            DAEMON_PIPE_BUFFER,
+            DAEMON_PIPE_BUFFER,
+            0,
+            NULL
         );
+
+        if (pipe == INVALID_HANDLE_VALUE) {
+            if (first) {
+                fatal("there is already a daemon running for %v", opt.dir);
+            }
+            fatal("couldn't create pipe: %v", os_get_error_string(os_get_last_error()));
+        }
+        first = 0;
+
+        if (ConnectNamedPipe(pipe, NULL) || GetLastError() == ERROR_PIPE_CONNECTED) {
+            daemon__serve(*arena, pipe);
+            FlushFileBuffers(pipe);
+        }
+
+        DisconnectNamedPipe(pipe);
+        CloseHandle(pipe);
     }
+}
 
-    return ostr_to_str(&out);
-    // return STR_EMPTY;
+// streams the results of this search from a running daemon to stdout,
+// returns false when the tree has to be walked instead
+bool daemon_query(arena_t scratch, int argc, char **argv) {
+    str_t pipe_name = daemon__pipe_name(&scratch, strv(opt.dir));
+    if (str_is_empty(pipe_name)) {
+        return false;
+    }
+
+    HANDLE pipe = CreateFileW(
+        path_to_wide(&scratch, strv(pipe_name)),
+        GENERIC_READ | GENERIC_WRITE,
+        0,
+        NULL,
+        OPEN_EXISTING,
+        0,
+        NULL
+    );
+
+    if (pipe == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    outstream_t request = ostr_init(&scratch);
+    ostr_puts(&request, strv("\0\0\0\0", 4));
+    for (int i = 1; i < argc; ++i) {
+        ostr_puts(&request, strv(argv[i]));
+        ostr_putc(&request, '\0');
+    }
+    str_t req = ostr_to_str(&request);
+    u32 len = (u32)(req.len - sizeof(u32));
+    memcpy(req.buf, &len, sizeof(len));
+
+    DWORD written = 0;
+    char status = 0;
+    bool served = WriteFile(pipe, req.buf, (DWORD)req.len, &written, NULL) &&
+                  daemon__read(pipe, &status, 1) &&
+                  status == '1';
+
+    if (status == '2') {
+        char error[512];
+        DWORD read = 0;
+        ReadFile(pipe, error, sizeof(error), &read, NULL);
+        warn("daemon refused the search: %v", strv(error, read));
+    }
+
+    if (served) {
+        u8 *buf = alloc(&scratch, u8, DAEMON_PIPE_BUFFER);
+        oshandle_t out = os_stdout();
+        DWORD read = 0;
+        while (ReadFile(pipe, buf, DAEMON_PIPE_BUFFER, &read, NULL) && read) {
+            if (os_file_write(out, buf, read) != read) {
+                break;
+            }
+        }
+    }
+
+    CloseHandle(pipe);
+    return served;
 }
 
 int main(int argc, char **argv) {
-    printf("> %d\n", COLLA_DEBUG);
     if (argc < 2) return usage();
 
     colla_init(COLLA_OS | COLLA_CORE);
@@ -434,93 +6847,193 @@ int main(int argc, char **argv) {
     icons_init(ICON_STYLE_NERD);
 
     opt = get_options(&arena, argc, argv);
+
+    if (opt.bench_counters) {
+        bench_counters();
+        return 0;
+    }
+
+    if (!str_is_empty(opt.bench_tree)) {
+        bench_tree(&arena, strv(opt.bench_tree));
+        return 0;
+    }
    
-    opt.tofind_original = str_dup(&arena, opt.tofind);
+    search_compile(&arena);
 
-    if (!opt.case_sensitive) {
-        str_upper(&opt.tofind);
+    if (!str_is_empty(opt.bench_match)) {
+        if (opt.mode != MATCH_MODE_SUBSTRING && opt.mode != MATCH_MODE_REGEX) {
+            fatal("--bench-match only supports substring and regex mode");
+        }
+        bench_match(&arena, strv(opt.bench_match));
+        return 0;
     }
 
     print_mtx = os_mutex_create();
 
-    jobs_mutex = os_mutex_create();
+    if (opt.sorted && opt.mode == MATCH_MODE_FUZZY) {
+        fatal("--sorted can't be used with -fuzzy, fuzzy results are already ranked");
+    }
+
+    if (opt.follow) {
+        if (opt.walker == WALKER_GENERIC) {
+            fatal("-L needs file ids from the listing, it doesn't work with --walk generic");
+        }
+        if (opt.daemon || !str_is_empty(opt.index)) {
+            fatal("-L can't be used with an index");
+        }
+    }
 
-    job_notif = os_cond_create();
+    if (opt.one_file_system && (opt.daemon || !str_is_empty(opt.index))) {
+        fatal("--one-file-system can't be used with an index");
+    }
 
-    jobdata_t *initial_job = alloc(&arena, jobdata_t);
-    initial_job->path = str_dup(&arena, opt.dir);
-    initial_job->alloc_len = opt.dir.len;
-    dlist_push(jobs, initial_job);
+    if (opt.max_results) {
+        if (opt.mode == MATCH_MODE_FUZZY) {
+            fatal("--max-results can't be used with -fuzzy, the best matches are only known at the end, use --top");
+        }
+        if (opt.sorted) {
+            fatal("--max-results can't be used with --sorted, the first matches found aren't the first ones in order");
+        }
+    }
 
-    for (int i = 0; i < opt.j; ++i) {
-        data[i].arena = arena_make(ARENA_VIRTUAL, GB(1));
-        data[i].scratch = arena_make(ARENA_VIRTUAL, GB(1));
-        threads[i] = os_thread_launch(worker, &data[i]);
+    if (!str_is_empty(opt.content)) {
+        if (opt.mode == MATCH_MODE_FUZZY || opt.sorted) {
+            fatal("-content can't be used with -fuzzy or --sorted");
+        }
+        if (opt.daemon || !str_is_empty(opt.index)) {
+            fatal("-content needs to open the files, it can't run from an index");
+        }
     }
 
-    app.spinner = spinner_init(SPINNER_DOT);
+    // the index lists everything, silently showing ignored files would be worse than refusing
+    if (!str_is_empty(opt.index) && !opt.no_ignore) {
+        fatal("--index doesn't know about ignore files, pass -I as well");
+    }
 
-    term_init(&(termdesc_t){
-        .app = {
-            .update = app_update,
-            .event = app_event,
-            .view = app_view,
-        },
-    });
+    if (opt.exec_count) {
+        if (opt.mode == MATCH_MODE_FUZZY || opt.sorted) {
+            fatal("-x and -X run on matches as they come, they can't be used with -fuzzy or --sorted");
+        }
+        if (opt.daemon || !str_is_empty(opt.content)) {
+            fatal("-x and -X can't be used with -daemon or -content");
+        }
+    }
 
-    term_run();
+    if (!opt.stream) {
+        // nobody is going to look at a spinner through a pipe, and sorted output
+        // only exists at the end anyway
+        opt.stream = opt.sorted || opt.daemon || opt.exec_count || opt.format != OUTPUT_FORMAT_LINES || !str_is_empty(opt.content) || !str_is_empty(opt.index) || GetFileType(GetStdHandle(STD_OUTPUT_HANDLE)) != FILE_TYPE_CHAR;
+    }
 
-#if 0
-    opt.j += 1;
-    
-    threads[0] = os_thread_launch(loading_thread, NULL);
+    if (opt.stream) {
+        output.handle = os_stdout();
+        output.mtx = os_mutex_create();
+        output.flush_ticks = term__get_ticks_per_second() * OUTPUT_FLUSH_MS / 1000;
+        output.begin = term__get_ticks();
+    }
 
-    for (int i = 1; i < opt.j; ++i) {
-        data[i].arena = arena_make(ARENA_VIRTUAL, GB(1));
-        threads[i] = os_thread_launch(worker, &data[i]);
+    // the daemon may not share our working directory, it can't stat relative paths for us,
+    // and its index doesn't know about ignore files
+    bool can_ask_daemon = opt.stream && opt.no_ignore && !opt.daemon && !opt.no_daemon && !opt.filters && !opt.follow && !opt.one_file_system &&
+                          !opt.exec_count && str_is_empty(opt.index) && str_is_empty(opt.content);
+    if (can_ask_daemon && daemon_query(arena, argc, argv)) {
+        return 0;
     }
 
-    bool finished = false;
+    park_mtx = os_mutex_create();
+    pool.mtx = os_mutex_create();
+    if (opt.follow) {
+        visited_init();
+    }
+    park_notif = os_cond_create();
+    done_notif = os_cond_create();
 
-    while (!finished) {
-        if (!os_mutex_try_lock(jobs_mutex)) {
-            continue;
+    for (int i = 0; i < opt.j; ++i) {
+        workers[i].arena = arena_make(ARENA_VIRTUAL, GB(1));
+        workers[i].scratch = arena_make(ARENA_VIRTUAL, GB(1));
+        workers[i].deque.ring = jobring_make(&workers[i].arena, JOBDEQUE_INITIAL_CAP);
+        workers[i].walk_buf = alloc(&workers[i].arena, u8, WALK_BUFFER_SIZE);
+        workers[i].batch = alloc(&workers[i].arena, jobdata_t *, JOB_BATCH_MAX);
+        if (opt.stream) {
+            workers[i].out_cap = opt.format == OUTPUT_FORMAT_LINES ? OUTPUT_BUFFER_SIZE : OUTPUT_MACHINE_BUFFER_SIZE;
+            workers[i].out_buf = alloc(&workers[i].arena, char, workers[i].out_cap);
+        }
+        if (!str_is_empty(opt.content)) {
+            workers[i].content_buf = alloc(&workers[i].arena, char, CONTENT_READ_MAX);
         }
+        if (opt.mode == MATCH_MODE_REGEX) {
+            workers[i].dfa = dfa_make(&workers[i].arena);
+        }
+        else if (opt.mode == MATCH_MODE_FUZZY) {
+            workers[i].fuzzy = fuzzyheap_make(&workers[i].arena);
+        }
+        workers[i].rng = (u32)i * 0x9E3779B9u + 1;
+    }
+
+    if (opt.exec_count) {
+        exec_start(&arena);
+    }
 
-        finished = ATOMIC_GET(jobs_in_progess) <= 0 && !jobs;
+    if (opt.daemon) {
+        return daemon_run(&arena);
+    }
 
-        os_mutex_unlock(jobs_mutex);
+    if (!str_is_empty(opt.index)) {
+        return index_run(&arena);
     }
 
-    ATOMIC_SET(should_quit, 1);
+    nt_create_file = (nt_create_file_f)GetProcAddress(GetModuleHandleA("ntdll.dll"), "NtCreateFile");
+    nt_query_directory_file = (nt_query_directory_file_f)GetProcAddress(GetModuleHandleA("ntdll.dll"), "NtQueryDirectoryFile");
+
+    if (opt.walker == WALKER_ASYNC) {
+        bool ok = nt_create_file && nt_query_directory_file;
+        for (int i = 0; ok && i < opt.j; ++i) {
+            ok = async_init(&workers[i]);
+        }
+        if (!ok) {
+            warn("couldn't set up overlapped directory reads, falling back to the batch walker");
+            opt.walker = WALKER_BATCH;
+        }
+    }
 
-    os_cond_broadcast(job_notif);
+    if (!nt_create_file && opt.walker == WALKER_BATCH) {
+        warn("couldn't load NtCreateFile, falling back to the generic walker");
+        opt.walker = WALKER_GENERIC;
+    }
 
-    // clear loading line
-    print("\33[2K\r");
+    if (opt.drop_caches) {
+        drop_caches();
+    }
 
-    for (int i = 0; i < opt.j; ++i) {
-        os_thread_join(threads[i], NULL);
+    jobdata_t *initial_job = alloc(&arena, jobdata_t);
+    initial_job->name = str_dup(&arena, opt.dir);
+    initial_job->pool_class = -1;
+    initial_job->open_refs = 1;
+    // never recycled, it isn't in any worker's arena
+    initial_job->refs = 2;
 
-        for_each(r, data[i].results) {
-            for (usize k = 0; k < r->count; ++k) {
-                result_t *res = &r->items[k]; 
+    pending_jobs = 1;
+    jobdeque_push(&workers[0], initial_job);
 
-                os_log_set_colour(LOG_COL_GREEN);
-                print("%v ", res->icon);
-                os_log_set_colour(LOG_COL_GREY);
-                print("%v", res->before);
-                os_log_set_colour(LOG_COL_YELLOW);
-                print("%v", res->name);
-                os_log_set_colour(LOG_COL_GREEN);
-                print("%v", opt.tofind_original);
-                os_log_set_colour(LOG_COL_YELLOW);
-                print("%v\n", res->after);
-            }
-        }
+    walk_begin = term__get_ticks();
+
+    for (int i = 0; i < opt.j; ++i) {
+        threads[i] = os_thread_launch(opt.walker == WALKER_ASYNC ? worker_async : worker, &workers[i]);
     }
 
-    print("\n");
-    println("found %d/%d", found_count, checked_count);
-#endif
+    if (opt.stream) {
+        return stream_run(&arena);
+    }
+
+    app.spinner = spinner_init(SPINNER_DOT);
+
+    term_init(&(termdesc_t){
+        .app = {
+            .update = app_update,
+            .event = app_event,
+            .view = app_view,
+        },
+    });
+
+    term_run();
 }
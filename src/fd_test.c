@@ -0,0 +1,308 @@
+#include "colla/build.c"
+
+// end to end tests for fd: every test builds a small tree in %TEMP%, runs
+// fd.exe inside it with stdout going to a file and checks what came out. fd is
+// run as a separate process so a hang shows up as a timeout instead of
+// taking the tests down with it
+//
+// usage: fd_test [path/to/fd.exe]
+
+#define TEST_TIMEOUT_MS 30000
+
+typedef struct fdrun_t fdrun_t;
+struct fdrun_t {
+    str_t out;
+    DWORD code;
+    bool timed_out;
+};
+
+strview_t fd_exe = cstrv("fd.exe");
+str_t test_root = {0};
+int tests_failed = 0;
+int tests_run = 0;
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            print("    failed: "); \
+            println(__VA_ARGS__); \
+            ok = false; \
+        } \
+    } while (0)
+
+str_t tree_path(arena_t *arena, strview_t rel) {
+    return str_fmt(arena, "%v\\%v", test_root, rel);
+}
+
+void tree_dir(arena_t scratch, strview_t rel) {
+    str_t path = tree_path(&scratch, rel);
+    if (!CreateDirectoryA(path.buf, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+        fatal("couldn't create %v: %v", path, os_get_error_string(os_get_last_error()));
+    }
+}
+
+void tree_file(arena_t scratch, strview_t rel, strview_t content) {
+    str_t path = tree_path(&scratch, rel);
+    if (!os_file_write_all_str(strv(path), content)) {
+        fatal("couldn't write %v", path);
+    }
+}
+
+DWORD run_cmd(arena_t scratch, strview_t cmdline, const char *cwd, HANDLE out, bool *timed_out) {
+    STARTUPINFOA startup = {
+        .cb = sizeof(startup),
+        .dwFlags = STARTF_USESTDHANDLES,
+        .hStdInput = GetStdHandle(STD_INPUT_HANDLE),
+        .hStdOutput = out ? out : GetStdHandle(STD_OUTPUT_HANDLE),
+        .hStdError = GetStdHandle(STD_ERROR_HANDLE),
+    };
+    PROCESS_INFORMATION process = {0};
+
+    str_t cmd = str(&scratch, cmdline);
+    if (!CreateProcessA(NULL, cmd.buf, NULL, NULL, TRUE, 0, NULL, cwd, &startup, &process)) {
+        fatal("couldn't run %v: %v", cmdline, os_get_error_string(os_get_last_error()));
+    }
+
+    DWORD code = 1;
+    if (WaitForSingleObject(process.hProcess, TEST_TIMEOUT_MS) == WAIT_TIMEOUT) {
+        TerminateProcess(process.hProcess, 1);
+        WaitForSingleObject(process.hProcess, INFINITE);
+        if (timed_out) *timed_out = true;
+    }
+    GetExitCodeProcess(process.hProcess, &code);
+    CloseHandle(process.hThread);
+    CloseHandle(process.hProcess);
+    return code;
+}
+
+// a junction doesn't need an elevated prompt, unlike a symlink
+void tree_junction(arena_t scratch, strview_t rel, strview_t target) {
+    str_t link = tree_path(&scratch, rel);
+    str_t dest = tree_path(&scratch, target);
+    str_t cmd = str_fmt(&scratch, "cmd /c mklink /J \"%v\" \"%v\" >nul", link, dest);
+    if (run_cmd(scratch, strv(cmd), NULL, NULL, NULL) != 0) {
+        fatal("couldn't create junction %v", link);
+    }
+}
+
+void tree_clear(arena_t scratch) {
+    // rmdir removes junctions without going through them
+    str_t cmd = str_fmt(&scratch, "cmd /c rmdir /s /q \"%v\"", test_root);
+    run_cmd(scratch, strv(cmd), NULL, NULL, NULL);
+    if (!CreateDirectoryA(test_root.buf, NULL)) {
+        fatal("couldn't create %v: %v", test_root, os_get_error_string(os_get_last_error()));
+    }
+}
+
+fdrun_t run_fd(arena_t *arena, strview_t args) {
+    fdrun_t run = {0};
+    arena_t scratch = *arena;
+
+    str_t out_path = str_fmt(&scratch, "%v.out", test_root);
+    SECURITY_ATTRIBUTES inherit = { .nLength = sizeof(inherit), .bInheritHandle = TRUE };
+    HANDLE out = CreateFileA(out_path.buf, GENERIC_WRITE, FILE_SHARE_READ, &inherit, CREATE_ALWAYS, 0, NULL);
+    if (out == INVALID_HANDLE_VALUE) {
+        fatal("couldn't create %v", out_path);
+    }
+
+    // relative paths, so the output doesn't depend on where %TEMP% is
+    str_t cmd = str_fmt(&scratch, "\"%v\" --no-daemon %v", fd_exe, args);
+    run.code = run_cmd(scratch, strv(cmd), test_root.buf, out, &run.timed_out);
+    CloseHandle(out);
+
+    run.out = os_file_read_all_str(arena, strv(out_path));
+    DeleteFileA(out_path.buf);
+    return run;
+}
+
+usize count_records(strview_t out, char sep) {
+    usize count = 0;
+    for (usize i = 0; i < out.len; ++i) {
+        count += out.buf[i] == sep;
+    }
+    return count;
+}
+
+bool contains(strview_t out, const char *needle) {
+    strview_t n = strv(needle);
+    for (usize i = 0; i + n.len <= out.len; ++i) {
+        if (memcmp(out.buf + i, n.buf, n.len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// == TESTS ===============
+
+// every alternative keeps its own anchors, ^a|b is (^a)|b and not ^(a|b)
+bool test_regex_anchors(arena_t arena) {
+    bool ok = true;
+    tree_file(arena, strv("apple"), strv("x"));
+    tree_file(arena, strv("crab"), strv("x"));
+    tree_file(arena, strv("plum"), strv("x"));
+
+    fdrun_t run = run_fd(&arena, strv("-r \"^a|b\""));
+    CHECK(count_records(strv(run.out), '\n') == 2, "^a|b should find apple and crab:\n%v", run.out);
+    CHECK(contains(strv(run.out), "crab\n"), "^a|b anchored the b too:\n%v", run.out);
+
+    run = run_fd(&arena, strv("-r \"e$|^p\""));
+    CHECK(count_records(strv(run.out), '\n') == 2, "e$|^p should find apple and plum:\n%v", run.out);
+    CHECK(!contains(strv(run.out), "crab"), "e$|^p found crab:\n%v", run.out);
+
+    // expands to a million copies, has to be turned down rather than compiled
+    run = run_fd(&arena, strv("-r \"(a{1000}){1000}\""));
+    CHECK(!run.timed_out, "the nested repetition didn't finish");
+    CHECK(run.code != 0, "the nested repetition was accepted");
+
+    return ok;
+}
+
+// with several names every match says which one it was
+bool test_multi_pattern_tags(arena_t arena) {
+    bool ok = true;
+    tree_file(arena, strv("foo.txt"), strv("x"));
+    tree_file(arena, strv("bar.txt"), strv("x"));
+
+    fdrun_t run = run_fd(&arena, strv("foo bar"));
+    CHECK(contains(strv(run.out), "foo.txt [foo]\n"), "foo.txt isn't tagged:\n%v", run.out);
+    CHECK(contains(strv(run.out), "bar.txt [bar]\n"), "bar.txt isn't tagged:\n%v", run.out);
+
+    run = run_fd(&arena, strv("--sorted foo bar"));
+    CHECK(contains(strv(run.out), "bar.txt [bar]\nfoo.txt [foo]\n"), "--sorted lost the tags:\n%v", run.out);
+
+    run = run_fd(&arena, strv("--jsonl foo bar"));
+    CHECK(contains(strv(run.out), "foo.txt\",\"pattern\":\"foo\"}"), "--jsonl has no pattern field:\n%v", run.out);
+
+    return ok;
+}
+
+// the generic walker only has names, the link has to come from a stat
+bool test_type_link_generic(arena_t arena) {
+    bool ok = true;
+    tree_dir(arena, strv("real"));
+    tree_junction(arena, strv("link"), strv("real"));
+
+    fdrun_t run = run_fd(&arena, strv("--walk generic --type l -e link"));
+    CHECK(count_records(strv(run.out), '\n') == 1, "--type l didn't find the junction:\n%v", run.out);
+
+    run = run_fd(&arena, strv("--walk generic --type d -e link"));
+    CHECK(count_records(strv(run.out), '\n') == 0, "--type d took the junction for a directory:\n%v", run.out);
+
+    return ok;
+}
+
+// a/b/up points back at a, without the visited set -L would go around forever
+bool test_follow_cycle(arena_t arena) {
+    bool ok = true;
+    tree_dir(arena, strv("a"));
+    tree_dir(arena, strv("a\\b"));
+    tree_file(arena, strv("a\\b\\file.txt"), strv("x"));
+    tree_junction(arena, strv("a\\b\\up"), strv("a"));
+
+    const char *walkers[] = { "batch", "async" };
+    for (int i = 0; i < arrlen(walkers); ++i) {
+        fdrun_t run = run_fd(&arena, strv(str_fmt(&arena, "-L --walk %s -e file.txt", walkers[i])));
+        CHECK(!run.timed_out, "-L --walk %s didn't finish", walkers[i]);
+        CHECK(run.code == 0, "-L --walk %s exited with %u", walkers[i], run.code);
+        CHECK(count_records(strv(run.out), '\n') == 1, "-L --walk %s found the file %llu times:\n%v", walkers[i], (u64)count_records(strv(run.out), '\n'), run.out);
+    }
+
+    // without -L the junction is listed but not walked into
+    fdrun_t run = run_fd(&arena, strv("-e file.txt"));
+    CHECK(count_records(strv(run.out), '\n') == 1, "without -L the file was found %llu times", (u64)count_records(strv(run.out), '\n'));
+
+    // the link is the only way onto another volume and it stays on this one
+    run = run_fd(&arena, strv("-L --one-file-system -e file.txt"));
+    CHECK(count_records(strv(run.out), '\n') == 1, "-L --one-file-system found the file %llu times", (u64)count_records(strv(run.out), '\n'));
+
+    return ok;
+}
+
+// with names this short the queue runs out of slots before -X has a full
+// command line, the launchers have to go anyway or the walk never ends
+bool test_exec_batch_short_names(arena_t arena) {
+    bool ok = true;
+    const char *digits = "0123456789abcdefghijklmnopqrstuvwxyz";
+    int count = 0;
+
+    for (int a = 0; a < 36; ++a) {
+        for (int b = 0; b < 36; ++b) {
+            char name[] = { digits[a], digits[b], 0 };
+            tree_file(arena, strv(name), STRV_EMPTY);
+            count++;
+        }
+    }
+    for (int i = 0; i < 3000; ++i) {
+        char name[] = { digits[i / 1296 + 1], digits[(i / 36) % 36], digits[i % 36], 0 };
+        tree_file(arena, strv(name), STRV_EMPTY);
+        count++;
+    }
+
+    fdrun_t run = run_fd(&arena, strv("--stats -g * -X cmd /c rem +"));
+    CHECK(!run.timed_out, "-X with %d short names didn't finish", count);
+    CHECK(run.code == 0, "-X exited with %u", run.code);
+    str_t expected = str_fmt(&arena, "for %d paths, 0 failed", count);
+    CHECK(contains(strv(run.out), expected.buf), "expected \"%v\" in:\n%v", expected, run.out);
+
+    return ok;
+}
+
+// a latin-1 file has bytes that aren't utf-8, json lines can't carry them as they are
+bool test_jsonl_invalid_utf8(arena_t arena) {
+    bool ok = true;
+    tree_file(arena, strv("latin1.txt"), strv("caf\xe9 needle\n"));
+    tree_file(arena, strv("utf8.txt"), strv("caf\xc3\xa9 needle\n"));
+
+    fdrun_t run = run_fd(&arena, strv("--jsonl -c needle"));
+    CHECK(run.code == 0, "--jsonl -c exited with %u", run.code);
+    CHECK(count_records(strv(run.out), '\n') == 2, "expected 2 hits:\n%v", run.out);
+    CHECK(contains(strv(run.out), "\"text\":\"caf\xef\xbf\xbd needle\""), "the latin-1 byte wasn't replaced:\n%v", run.out);
+    CHECK(contains(strv(run.out), "\"text\":\"caf\xc3\xa9 needle\""), "valid utf-8 was changed:\n%v", run.out);
+    CHECK(!contains(strv(run.out), "\xe9 "), "a raw latin-1 byte made it to the output:\n%v", run.out);
+
+    return ok;
+}
+
+typedef struct testdesc_t testdesc_t;
+struct testdesc_t {
+    const char *name;
+    bool (*fn)(arena_t arena);
+};
+
+testdesc_t tests[] = {
+    { "regex anchors", test_regex_anchors },
+    { "multi pattern tags", test_multi_pattern_tags },
+    { "type link generic walker", test_type_link_generic },
+    { "follow cycle", test_follow_cycle },
+    { "exec batch short names", test_exec_batch_short_names },
+    { "jsonl invalid utf-8", test_jsonl_invalid_utf8 },
+};
+
+int main(int argc, char **argv) {
+    colla_init(COLLA_OS | COLLA_CORE);
+    arena_t arena = arena_make(ARENA_VIRTUAL, GB(1));
+
+    if (argc > 1) {
+        fd_exe = strv(argv[1]);
+    }
+
+    char temp[MAX_PATH] = {0};
+    GetTempPathA(sizeof(temp), temp);
+    test_root = str_fmt(&arena, "%sfd_test_%u", temp, GetCurrentProcessId());
+
+    for (int i = 0; i < arrlen(tests); ++i) {
+        tree_clear(arena);
+        println("%s", tests[i].name);
+        tests_run++;
+        if (!tests[i].fn(arena)) {
+            tests_failed++;
+        }
+    }
+
+    str_t cmd = str_fmt(&arena, "cmd /c rmdir /s /q \"%v\"", test_root);
+    run_cmd(arena, strv(cmd), NULL, NULL, NULL);
+
+    println("%d/%d passed", tests_run - tests_failed, tests_run);
+    return tests_failed ? 1 : 0;
+}